@@ -0,0 +1,47 @@
+#include "CheckpointManager.h"
+
+namespace hlkvds {
+
+CheckpointManager::CheckpointManager(SuperBlockManager* sbm, IndexManager* im,
+                                     SegmentManager* sm, Options &opt) :
+    sbMgr_(sbm), idxMgr_(im), segMgr_(sm), options_(opt) {
+}
+
+CheckpointManager::~CheckpointManager() {
+}
+
+bool CheckpointManager::Checkpoint(bool full) {
+    std::lock_guard<std::mutex> l(ckptMtx_);
+    uint64_t gen = sbMgr_->GetCheckpointGen() + 1;
+
+    if (!idxMgr_->WriteIndexToDevice(gen, full)) {
+        __ERROR("Checkpoint %lu could not write index to device", gen);
+        return false;
+    }
+
+    //index segments allocated by the checkpoint are in the segment table
+    if (!segMgr_->WriteSegmentTableToDevice(!full)) {
+        __ERROR("Checkpoint %lu could not write segment table to device", gen);
+        idxMgr_->AbortCheckpoint();
+        return false;
+    }
+
+    if (!sbMgr_->WriteSuperBlockToDevice()) {
+        __ERROR("Checkpoint %lu could not write superblock to device", gen);
+        idxMgr_->AbortCheckpoint();
+        return false;
+    }
+
+    idxMgr_->CommitCheckpoint();
+    __DEBUG("Checkpoint %lu committed", gen);
+    return true;
+}
+
+void CheckpointManager::BackCheckpoint() {
+    if (!idxMgr_->GetDirtyRangeNum() && !segMgr_->GetDirtyPageNum()) {
+        return;
+    }
+    Checkpoint(false);
+}
+
+}//namespace hlkvds
@@ -0,0 +1,85 @@
+#include <thread>
+#include <functional>
+
+#include "EpochManager.h"
+
+namespace hlkvds {
+
+EpochManager::EpochManager() :
+    epoch_(0), retiredNum_(0) {
+    for (int i = 0; i < EPOCH_READER_SLOT_NUM; i++) {
+        slots_[i].active[0].store(0);
+        slots_[i].active[1].store(0);
+    }
+}
+
+EpochManager::~EpochManager() {
+    Reclaim(true);
+}
+
+int EpochManager::EnterRead() {
+    //spread reader threads over the slots to keep the counters uncontended
+    static thread_local uint32_t slot = std::hash<std::thread::id>()(
+            std::this_thread::get_id()) % EPOCH_READER_SLOT_NUM;
+
+    uint32_t parity = epoch_.load() & 1;
+    slots_[slot].active[parity].fetch_add(1);
+    return (int)(slot * 2 + parity);
+}
+
+void EpochManager::ExitRead(int token) {
+    slots_[token / 2].active[token % 2].fetch_sub(1);
+}
+
+void EpochManager::Retire(void* ptr, void (*deleter)(void*)) {
+    Retired r = { ptr, deleter };
+    std::lock_guard<std::mutex> l(retireMtx_);
+    retired_.push_back(r);
+    retiredNum_.store(retired_.size());
+}
+
+void EpochManager::Reclaim(bool force) {
+    if (!force && retiredNum_.load() < EPOCH_RECLAIM_BATCH) {
+        return;
+    }
+    std::unique_lock<std::mutex> rl(reclaimMtx_, std::defer_lock);
+    if (force) {
+        rl.lock();
+    } else if (!rl.try_lock()) {
+        //someone else is reclaiming
+        return;
+    }
+
+    vector<Retired> batch;
+    {
+        std::lock_guard<std::mutex> l(retireMtx_);
+        batch.swap(retired_);
+        retiredNum_.store(0);
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    synchronize();
+
+    for (vector<Retired>::iterator iter = batch.begin(); iter != batch.end();
+            iter++) {
+        iter->deleter(iter->ptr);
+    }
+    __DEBUG("EpochManager reclaimed %lu objects", batch.size());
+}
+
+void EpochManager::synchronize() {
+    //A reader may load the epoch before a flip but count itself after it,
+    //waiting on both parities covers it
+    for (int round = 0; round < 2; round++) {
+        uint32_t parity = epoch_.fetch_add(1) & 1;
+        for (int i = 0; i < EPOCH_READER_SLOT_NUM; i++) {
+            while (slots_[i].active[parity].load()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+}// namespace hlkvds
@@ -3,7 +3,7 @@
 namespace hlkvds {
 GcManager::~GcManager() {
     if (dataBuf_) {
-        delete[] dataBuf_;
+        KVHugeMem::Free(dataBuf_, segMgr_->GetSegmentSize());
     }
 }
 
@@ -129,8 +129,11 @@ void GcManager::FullGC() {
 uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
     if (!dataBuf_) {
         uint32_t seg_size = segMgr_->GetSegmentSize();
-        //dataBuf_ = new char[seg_size];
-        posix_memalign((void **)&dataBuf_, 4096, seg_size);
+        dataBuf_ = (char *) KVHugeMem::Alloc(seg_size);
+        if (!dataBuf_) {
+            __ERROR("Could not alloc the GC segment buffer");
+            return 0;
+        }
     }
 
     bool ret;
@@ -177,9 +180,11 @@ uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
     uint32_t seg_first_id;
     segMgr_->AllocForGC(seg_first_id);
     seg_first->SetSegId(seg_first_id);
+    seg_first->SetSeqNum(idxMgr_->NextSegSeqNum());
     ret = seg_first->WriteSegToDevice();
     if (!ret) {
         __ERROR("Write First GC segment to device failed, free 0 segments");
+        idxMgr_->SegApplied(seg_first->GetSeqNum());
         delete seg_first;
         segMgr_->FreeForFailed(seg_first_id);
         cleanKvList(recycle_list);
@@ -191,6 +196,7 @@ uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
     segMgr_->Use(seg_first_id, free_size);
 
     seg_first->UpdateToIndex();
+    idxMgr_->SegApplied(seg_first->GetSeqNum());
 
     //clean work for first segment
     for (std::vector<uint32_t>::iterator iter = free_seg_vec.begin(); iter
@@ -214,13 +220,22 @@ uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
 
     for (slice_iter = slice_list.begin(); slice_iter != slice_list.end(); ++slice_iter) {
         KVSlice* slice = *slice_iter;
+        if (!seg_second->TryPut(slice)) {
+            __ERROR("Cann't put to Second GC segment, but First Segment is completed, free %d segments", total_free);
+            delete seg_second;
+            segMgr_->FreeForFailed(seg_second_id);
+            cleanKvList(slice_list);
+            return total_free;
+        }
         seg_second->Put(slice);
     }
 
     seg_second->SetSegId(seg_second_id);
+    seg_second->SetSeqNum(idxMgr_->NextSegSeqNum());
     ret = seg_second->WriteSegToDevice();
     if (!ret) {
         __ERROR("Write Second GC segment to device failed, but First Segment is completed, free %d segments", total_free);
+        idxMgr_->SegApplied(seg_second->GetSeqNum());
         delete seg_second;
         segMgr_->FreeForFailed(seg_second_id);
         cleanKvList(slice_list);
@@ -231,6 +246,7 @@ uint32_t GcManager::doMerge(std::multimap<uint32_t, uint32_t> &cands_map) {
     segMgr_->Use(seg_second_id, free_size);
 
     seg_second->UpdateToIndex();
+    idxMgr_->SegApplied(seg_second->GetSeqNum());
     segMgr_->FreeForGC(last_seg_id);
 
     //clean work for second segment
@@ -260,7 +276,7 @@ void GcManager::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
         memcpy(&header, &dataBuf_[head_offset],
                IndexManager::SizeOfDataHeader());
 
-        HashEntry hash_entry(header, phy_offset + (uint64_t) head_offset, NULL);
+        HashEntry hash_entry(header, phy_offset + (uint64_t) head_offset);
         __DEBUG("load hash_entry from seg_offset = %ld, header_offset = %d", phy_offset, head_offset );
 
         if (idxMgr_->IsSameInMem(hash_entry)) {
@@ -289,6 +305,8 @@ void GcManager::loadSegKV(list<KVSlice*> &slice_list, uint32_t num_keys,
 #else
                 KVSlice *slice = new KVSlice(&digest, data, data_len);
 #endif
+                //the copy keeps its write order, a newer write of the key wins
+                slice->SetSeqNum(header.GetSeqNum());
 
                 slice_list.push_back(slice);
                 __DEBUG("the slice key_digest = %s, value = %s, seg_offset = %ld, head_offset = %d is valid, need to write", digest.GetDigest(), data, phy_offset, head_offset);
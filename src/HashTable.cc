@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "HashTable.h"
+
+namespace hlkvds {
+
+template <class Slot>
+HashBucket<Slot>::HashBucket() :
+    next_(NULL), seq_(0), moved_(false) {
+    memset(tags_, 0, sizeof(tags_));
+}
+
+template <class Slot>
+HashBucket<Slot>::~HashBucket() {
+    Clear();
+}
+
+template <class Slot>
+void HashBucket<Slot>::Clear() {
+    memset(tags_, 0, sizeof(tags_));
+    HashBucket *next = next_.load();
+    if (next) {
+        DeleteBuckets(next, 1);
+        next_.store(NULL);
+    }
+}
+
+template <class Slot>
+void HashBucket<Slot>::RetireAll(EpochManager& epoch) {
+    writeBegin();
+    memset(tags_, 0, sizeof(tags_));
+    HashBucket *next = next_.load();
+    if (next) {
+        next_.store(NULL);
+        epoch.Retire(next, deleteBucket);
+    }
+    moved_.store(true, std::memory_order_relaxed);
+    writeEnd();
+}
+
+template <class Slot>
+HashBucket<Slot>* HashBucket<Slot>::NewBuckets(uint32_t num, uint32_t nodes) {
+    void *mem = NULL;
+    size_t len = sizeof(HashBucket) * (size_t) num;
+    //a chunk is a whole number of pages, so are its bytes. A huge page
+    //would span the chunks of several nodes
+    if (nodes > 1) {
+        if (posix_memalign(&mem, 4096, len)) {
+            mem = NULL;
+        }
+    } else {
+        mem = KVHugeMem::Alloc(len, 64);
+    }
+    if (!mem) {
+        throw std::bad_alloc();
+    }
+    HashBucket *buckets = (HashBucket *) mem;
+    //place the pages before they are touched
+    if (nodes > 1) {
+        int host_nodes = KVNuma::NodeNum();
+        for (uint32_t i = 0; i < num; i += INDEX_NUMA_CHUNK) {
+            uint32_t chunk = std::min(num - i, (uint32_t) INDEX_NUMA_CHUNK);
+            KVNuma::BindMemory(&buckets[i], sizeof(HashBucket) * chunk,
+                               (i / INDEX_NUMA_CHUNK) % nodes % host_nodes);
+        }
+    }
+    for (uint32_t i = 0; i < num; i++) {
+        new (&buckets[i]) HashBucket();
+    }
+    return buckets;
+}
+
+template <class Slot>
+void HashBucket<Slot>::DeleteBuckets(HashBucket* buckets, uint32_t num) {
+    for (uint32_t i = 0; i < num; i++) {
+        buckets[i].~HashBucket();
+    }
+    KVHugeMem::Free(buckets, sizeof(HashBucket) * (size_t) num);
+}
+
+template <class Slot>
+void HashBucket<Slot>::deleteBucket(void* ptr) {
+    DeleteBuckets((HashBucket *) ptr, 1);
+}
+
+template <class Slot>
+void HashBucket<Slot>::writeBegin() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+template <class Slot>
+void HashBucket<Slot>::writeEnd() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+template <class Slot>
+bool HashBucket<Slot>::readValidate(uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) == seq;
+}
+
+// Returns a mask with bit (2 * pos) set for every slot whose tag matches.
+template <class Slot>
+uint32_t HashBucket<Slot>::matchTag(uint16_t tag) const {
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi16((short) tag);
+    __m128i tags = _mm_load_si128((const __m128i *) tags_);
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(needle, tags)) & 0x5555;
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < BUCKET_ENTRY_NUM; i++) {
+        if (tags_[i] == tag) {
+            mask |= 1 << (2 * i);
+        }
+    }
+    return mask;
+#endif
+}
+
+template <class Slot>
+bool HashBucket<Slot>::isEmpty() const {
+    return matchTag(0) == 0x5555;
+}
+
+template <class Slot>
+template <class Match>
+Slot* HashBucket<Slot>::Get(uint16_t tag, Match match) {
+    HashBucket *bucket = this;
+    while (bucket) {
+        uint32_t mask = bucket->matchTag(tag);
+        while (mask) {
+            int pos = __builtin_ctz(mask) >> 1;
+            Slot *slot = &bucket->entries_[pos];
+            if (match(*slot)) {
+                return slot;
+            }
+            mask &= mask - 1;
+        }
+        bucket = bucket->next_.load(std::memory_order_relaxed);
+    }
+    return NULL;
+}
+
+template <class Slot>
+template <class Match, class Found>
+typename HashBucket<Slot>::ReadResult HashBucket<Slot>::Read(uint16_t tag,
+                                                             Match match,
+                                                             Found found) {
+    uint32_t seq = seq_.load(std::memory_order_acquire);
+    if (seq & 1) {
+        return READ_RETRY;
+    }
+    if (IsMoved()) {
+        return readValidate(seq) ? READ_MOVED : READ_RETRY;
+    }
+
+    bool hit = false;
+    HashBucket *bucket = this;
+    while (bucket) {
+        uint32_t mask = bucket->matchTag(tag);
+        while (mask) {
+            int pos = __builtin_ctz(mask) >> 1;
+            const Slot *slot = &bucket->entries_[pos];
+            if (match(*slot)) {
+                hit = true;
+                if (found(*slot)) {
+                    return readValidate(seq) ? READ_HIT : READ_RETRY;
+                }
+            }
+            mask &= mask - 1;
+        }
+        bucket = bucket->next_.load(std::memory_order_acquire);
+    }
+    if (!readValidate(seq)) {
+        return READ_RETRY;
+    }
+    return hit ? READ_HIT : READ_MISS;
+}
+
+template <class Slot>
+template <class Match>
+bool HashBucket<Slot>::Put(uint16_t tag, const Slot& slot, Match match) {
+    bool is_new = true;
+
+    writeBegin();
+    Slot *slot_inMem = Get(tag, match);
+    if (slot_inMem) {
+        *slot_inMem = slot;
+        is_new = false;
+    } else {
+        HashBucket *bucket = this;
+        while (true) {
+            uint32_t mask = bucket->matchTag(0);
+            if (mask) {
+                int pos = __builtin_ctz(mask) >> 1;
+                bucket->entries_[pos] = slot;
+                bucket->tags_[pos] = tag;
+                break;
+            }
+            if (!bucket->next_.load(std::memory_order_relaxed)) {
+                bucket->next_.store(NewBuckets(1), std::memory_order_release);
+            }
+            bucket = bucket->next_.load(std::memory_order_relaxed);
+        }
+    }
+    writeEnd();
+    return is_new;
+}
+
+template <class Slot>
+template <class Match>
+bool HashBucket<Slot>::Remove(uint16_t tag, Match match, EpochManager& epoch) {
+    HashBucket *pre = NULL;
+    HashBucket *bucket = this;
+    while (bucket) {
+        uint32_t mask = bucket->matchTag(tag);
+        while (mask) {
+            int pos = __builtin_ctz(mask) >> 1;
+            if (match(bucket->entries_[pos])) {
+                writeBegin();
+                bucket->tags_[pos] = 0;
+                //release the overflow bucket once it is empty
+                if (pre && bucket->isEmpty()) {
+                    pre->next_.store(bucket->next_.load());
+                    bucket->next_.store(NULL);
+                    epoch.Retire(bucket, deleteBucket);
+                }
+                writeEnd();
+                return true;
+            }
+            mask &= mask - 1;
+        }
+        pre = bucket;
+        bucket = bucket->next_.load(std::memory_order_relaxed);
+    }
+    return false;
+}
+
+template <class Slot>
+void HashBucket<Slot>::GetSlots(vector<Slot>& slots, vector<uint16_t>& tags) {
+    for (HashBucket *bucket = this; bucket; bucket = bucket->next_.load()) {
+        for (int i = 0; i < BUCKET_ENTRY_NUM; i++) {
+            if (bucket->tags_[i]) {
+                slots.push_back(bucket->entries_[i]);
+                tags.push_back(bucket->tags_[i]);
+            }
+        }
+    }
+}
+
+template <>
+uint32_t BucketTable<HashEntry>::slotHash(const HashEntry& slot) {
+    Kvdb_Digest digest = slot.GetKeyDigest();
+    return KeyDigestHandle::Hash(&digest);
+}
+
+template <>
+HashEntry BucketTable<HashEntry>::slotEntry(const HashEntry& slot,
+                                            uint16_t tag) {
+    return slot;
+}
+
+template <>
+uint32_t BucketTable<LeanEntry>::slotHash(const LeanEntry& slot) {
+    return slot.GetHash();
+}
+
+template <>
+HashEntry BucketTable<LeanEntry>::slotEntry(const LeanEntry& slot,
+                                            uint16_t tag) {
+    return slot.ToEntry(tag);
+}
+
+template <class Slot>
+BucketTable<Slot>::BucketTable(uint32_t ht_size, uint32_t lock_num,
+                               uint32_t numa_nodes) :
+    retiredState_(NULL), bucketNum_(0), minBucketNum_(1), numaNodes_(1),
+            locks_(NULL), lockNum_(1), resizing_(false), resizeNum_(0),
+            migrateCur_(0) {
+    //ht_size is power of 2, so is the bucket number
+    if (ht_size > BUCKET_ENTRY_NUM) {
+        minBucketNum_ = ht_size / BUCKET_ENTRY_NUM;
+    }
+    //a power of 2 not above the bucket number
+    while (lockNum_ < minBucketNum_ && (lockNum_ << 1) <= lock_num) {
+        lockNum_ <<= 1;
+    }
+    locks_ = new std::mutex[lockNum_];
+    //a power of 2 as well
+    while ((numaNodes_ << 1) <= numa_nodes && numaNodes_ < (1U << 16)) {
+        numaNodes_ <<= 1;
+    }
+
+    TableState *st = new TableState;
+    st->buckets = Bucket::NewBuckets(minBucketNum_, numaNodes_);
+    st->bucketNum = minBucketNum_;
+    st->oldBuckets = NULL;
+    st->oldBucketNum = 0;
+    state_.store(st);
+    bucketNum_.store(minBucketNum_);
+}
+
+template <class Slot>
+BucketTable<Slot>::~BucketTable() {
+    TableState *st = state_.load();
+    Bucket::DeleteBuckets(st->buckets, st->bucketNum);
+    if (st->oldBuckets) {
+        Bucket::DeleteBuckets(st->oldBuckets, st->oldBucketNum);
+    }
+    delete st;
+    delete retiredState_;
+    delete[] locks_;
+}
+
+template <class Slot>
+HashBucket<Slot>* BucketTable<Slot>::locateBucket(TableState* st,
+                                                  uint32_t hash) {
+    if (st->oldBuckets) {
+        Bucket *old_bucket = &st->oldBuckets[hash & (st->oldBucketNum - 1)];
+        if (!old_bucket->IsMoved()) {
+            return old_bucket;
+        }
+    }
+    return &st->buckets[hash & (st->bucketNum - 1)];
+}
+
+template <class Slot>
+template <class Match, class Found>
+typename HashBucket<Slot>::ReadResult BucketTable<Slot>::readState(
+        TableState* st, uint32_t hash, uint16_t tag, Match match, Found found) {
+    if (st->oldBuckets) {
+        Bucket *old_bucket = &st->oldBuckets[hash & (st->oldBucketNum - 1)];
+        typename Bucket::ReadResult r = old_bucket->Read(tag, match, found);
+        if (r != Bucket::READ_MOVED) {
+            return r;
+        }
+    }
+    typename Bucket::ReadResult r =
+            st->buckets[hash & (st->bucketNum - 1)].Read(tag, match, found);
+    //a new table never has moved buckets
+    return r == Bucket::READ_MOVED ? Bucket::READ_RETRY : r;
+}
+
+template <class Slot>
+void BucketTable<Slot>::GetEntries(uint32_t no, vector<HashEntry>& entries) {
+    std::lock_guard<std::mutex> l(locks_[no & (lockNum_ - 1)]);
+    TableState *st = state_.load();
+    if (no >= st->bucketNum) {
+        return;
+    }
+    vector<Slot> slots;
+    vector<uint16_t> tags;
+    st->buckets[no].GetSlots(slots, tags);
+    uint32_t num = slots.size();
+
+    //slots not moved yet from the old buckets which map to bucket no
+    if (st->oldBuckets) {
+        for (uint32_t old_no = no & (st->oldBucketNum - 1);
+                old_no < st->oldBucketNum; old_no += st->bucketNum) {
+            if (!st->oldBuckets[old_no].IsMoved()) {
+                st->oldBuckets[old_no].GetSlots(slots, tags);
+            }
+        }
+    }
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        if (i < num || (slotHash(slots[i]) & (st->bucketNum - 1)) == no) {
+            entries.push_back(slotEntry(slots[i], tags[i]));
+        }
+    }
+}
+
+template <class Slot>
+void BucketTable<Slot>::CheckResize(uint32_t key_num) {
+    if (resizing_.load()) {
+        return;
+    }
+    uint32_t bucket_num = GetBucketNum();
+    uint64_t capacity = (uint64_t) bucket_num * BUCKET_ENTRY_NUM;
+    if (key_num >= capacity && bucket_num < BUCKET_MAX_NUM) {
+        startResize(bucket_num * 2);
+    } else if (key_num < capacity / 8 && bucket_num > minBucketNum_) {
+        startResize(bucket_num / 2);
+    }
+}
+
+template <class Slot>
+void BucketTable<Slot>::startResize(uint32_t bucket_num) {
+    std::unique_lock<std::mutex> l(resizeMtx_, std::try_to_lock);
+    if (!l.owns_lock() || resizing_.load()) {
+        return;
+    }
+
+    TableState *cur = state_.load();
+    TableState *st = new TableState;
+    st->buckets = Bucket::NewBuckets(bucket_num, numaNodes_);
+    st->bucketNum = bucket_num;
+    st->oldBuckets = cur->buckets;
+    st->oldBucketNum = cur->bucketNum;
+
+    migrateCur_ = 0;
+    state_.store(st);
+    bucketNum_.store(bucket_num);
+    resizeNum_++;
+    //cur may still be read by someone holding a bucket lock
+    retiredState_ = cur;
+    resizing_.store(true);
+    __DEBUG("HashTable start resize from %u to %u buckets", st->oldBucketNum, bucket_num);
+}
+
+template <class Slot>
+void BucketTable<Slot>::MigrateStep() {
+    epoch_.Reclaim(false);
+
+    if (!resizing_.load()) {
+        return;
+    }
+    std::unique_lock<std::mutex> l(resizeMtx_, std::try_to_lock);
+    if (!l.owns_lock() || !resizing_.load()) {
+        return;
+    }
+
+    TableState *st = state_.load();
+    for (int i = 0; i < BUCKET_MIGRATE_STEP && migrateCur_ < st->oldBucketNum;
+            i++, migrateCur_++) {
+        std::lock_guard<std::mutex> bl(locks_[migrateCur_ & (lockNum_ - 1)]);
+        migrateBucket(st, migrateCur_);
+    }
+
+    if (migrateCur_ == st->oldBucketNum) {
+        finishResize(st);
+    }
+}
+
+template <class Slot>
+void BucketTable<Slot>::migrateBucket(TableState* st, uint32_t old_no) {
+    Bucket *old_bucket = &st->oldBuckets[old_no];
+    vector<Slot> slots;
+    vector<uint16_t> tags;
+    old_bucket->GetSlots(slots, tags);
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        uint32_t no = slotHash(slots[i]) & (st->bucketNum - 1);
+        //every slot of the old bucket is a distinct one
+        st->buckets[no].Put(tags[i], slots[i],
+                            [](const Slot&) { return false; });
+    }
+    old_bucket->RetireAll(epoch_);
+}
+
+template <class Slot>
+void BucketTable<Slot>::finishResize(TableState* st) {
+    TableState *done = new TableState;
+    done->buckets = st->buckets;
+    done->bucketNum = st->bucketNum;
+    done->oldBuckets = NULL;
+    done->oldBucketNum = 0;
+    state_.store(done);
+
+    //wait out everyone who loaded st under a bucket lock, lock-free
+    //readers are waited for by the epoch manager
+    for (uint32_t i = 0; i < lockNum_; i++) {
+        std::lock_guard<std::mutex> bl(locks_[i]);
+    }
+
+    epoch_.Retire(st, deleteOldTable);
+    epoch_.Retire(retiredState_, deleteState);
+    retiredState_ = NULL;
+    resizing_.store(false);
+    __DEBUG("HashTable finish resize to %u buckets", done->bucketNum);
+}
+
+template <class Slot>
+void BucketTable<Slot>::deleteState(void* ptr) {
+    delete (TableState *) ptr;
+}
+
+template <class Slot>
+void BucketTable<Slot>::deleteOldTable(void* ptr) {
+    TableState *st = (TableState *) ptr;
+    Bucket::DeleteBuckets(st->oldBuckets, st->oldBucketNum);
+    delete st;
+}
+
+template class HashBucket<HashEntry>;
+template class HashBucket<LeanEntry>;
+template class BucketTable<HashEntry>;
+template class BucketTable<LeanEntry>;
+
+HashTable::HashTable(uint32_t ht_size, uint32_t lock_num, uint32_t numa_nodes) :
+    BucketTable<HashEntry>(ht_size, lock_num, numa_nodes) {
+}
+
+HashEntry* HashTable::Get(const Kvdb_Digest& digest) {
+    Bucket *bucket = locateBucket(state_.load(), KeyDigestHandle::Hash(&digest));
+    return bucket->Get(KeyDigestHandle::Tag(&digest),
+                       [&](const HashEntry& slot) {
+                           return slot.GetKeyDigest() == digest;
+                       });
+}
+
+bool HashTable::Put(const HashEntry& entry) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    Bucket *bucket = locateBucket(state_.load(), KeyDigestHandle::Hash(&digest));
+    return bucket->Put(KeyDigestHandle::Tag(&digest), entry,
+                       [&](const HashEntry& slot) {
+                           return slot.GetKeyDigest() == digest;
+                       });
+}
+
+bool HashTable::Remove(const Kvdb_Digest& digest) {
+    Bucket *bucket = locateBucket(state_.load(), KeyDigestHandle::Hash(&digest));
+    return bucket->Remove(KeyDigestHandle::Tag(&digest),
+                          [&](const HashEntry& slot) {
+                              return slot.GetKeyDigest() == digest;
+                          }, epoch_);
+}
+
+bool HashTable::Lookup(const Kvdb_Digest& digest, HashEntry& entry) {
+    uint32_t hash = KeyDigestHandle::Hash(&digest);
+    uint16_t tag = KeyDigestHandle::Tag(&digest);
+    Bucket::ReadResult r = Bucket::READ_RETRY;
+
+    int token = epoch_.EnterRead();
+    for (int i = 0; i < OPTIMISTIC_READ_RETRY && r == Bucket::READ_RETRY;
+            i++) {
+        r = readState(state_.load(), hash, tag,
+                      [&](const HashEntry& slot) {
+                          return slot.GetKeyDigest() == digest;
+                      },
+                      [&](const HashEntry& slot) {
+                          entry = slot;
+                          return true;
+                      });
+    }
+    epoch_.ExitRead(token);
+
+    if (r != Bucket::READ_RETRY) {
+        return r == Bucket::READ_HIT;
+    }
+
+    //the bucket keeps changing under us, wait for the writers instead
+    std::lock_guard<std::mutex> l(GetLock(digest));
+    HashEntry *entry_inMem = Get(digest);
+    if (!entry_inMem) {
+        return false;
+    }
+    entry = *entry_inMem;
+    return true;
+}
+
+LeanHashTable::LeanHashTable(uint32_t ht_size, uint32_t lock_num,
+                             uint32_t numa_nodes) :
+    BucketTable<LeanEntry>(ht_size, lock_num, numa_nodes) {
+}
+
+void LeanHashTable::Lookup(const Kvdb_Digest& digest,
+                           vector<HashEntry>& entries) {
+    uint32_t hash = KeyDigestHandle::Hash(&digest);
+    uint16_t tag = KeyDigestHandle::Tag(&digest);
+    Bucket::ReadResult r = Bucket::READ_RETRY;
+    size_t num = entries.size();
+
+    int token = epoch_.EnterRead();
+    for (int i = 0; i < OPTIMISTIC_READ_RETRY && r == Bucket::READ_RETRY;
+            i++) {
+        entries.resize(num);
+        r = readState(state_.load(), hash, tag,
+                      [&](const LeanEntry& slot) {
+                          return slot.GetHash() == hash;
+                      },
+                      [&](const LeanEntry& slot) {
+                          entries.push_back(slot.ToEntry(tag));
+                          return false;
+                      });
+    }
+    epoch_.ExitRead(token);
+
+    if (r != Bucket::READ_RETRY) {
+        if (r != Bucket::READ_HIT) {
+            entries.resize(num);
+        }
+        return;
+    }
+
+    //the bucket keeps changing under us, wait for the writers instead
+    entries.resize(num);
+    std::lock_guard<std::mutex> l(GetLock(digest));
+    Get(digest, entries);
+}
+
+void LeanHashTable::Get(const Kvdb_Digest& digest, vector<HashEntry>& entries) {
+    uint32_t hash = KeyDigestHandle::Hash(&digest);
+    uint16_t tag = KeyDigestHandle::Tag(&digest);
+    Bucket *bucket = locateBucket(state_.load(), hash);
+    //collect every slot of the fingerprint, the match never accepts
+    bucket->Get(tag, [&](const LeanEntry& slot) {
+        if (slot.GetHash() == hash) {
+            entries.push_back(slot.ToEntry(tag));
+        }
+        return false;
+    });
+}
+
+bool LeanHashTable::Put(const HashEntry& entry, uint64_t old_offset) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    uint32_t hash = KeyDigestHandle::Hash(&digest);
+    Bucket *bucket = locateBucket(state_.load(), hash);
+    return bucket->Put(KeyDigestHandle::Tag(&digest), LeanEntry(entry),
+                       [&](const LeanEntry& slot) {
+                           return old_offset != NO_OFFSET
+                                   && slot.GetHash() == hash
+                                   && slot.GetHeaderOffsetPhy() == old_offset;
+                       });
+}
+
+bool LeanHashTable::Remove(const Kvdb_Digest& digest, uint64_t offset) {
+    uint32_t hash = KeyDigestHandle::Hash(&digest);
+    Bucket *bucket = locateBucket(state_.load(), hash);
+    return bucket->Remove(KeyDigestHandle::Tag(&digest),
+                          [&](const LeanEntry& slot) {
+                              return slot.GetHash() == hash
+                                      && slot.GetHeaderOffsetPhy() == offset;
+                          }, epoch_);
+}
+
+}// namespace hlkvds
@@ -4,34 +4,39 @@
 #include <unistd.h>
 
 #include <iostream>
+#include <algorithm>
+#include <thread>
 
 #include "IndexManager.h"
+#include "Segment.h"
+#include "HashTable.h"
+#include "PagedHashTable.h"
 
 namespace hlkvds {
 
 #ifdef WITH_ITERATOR
 DataHeader::DataHeader() :
     key_digest(Kvdb_Digest()), key_size(0), data_size(0), data_offset(0),
-            next_header_offset(0) {
+            next_header_offset(0), seq_num(0) {
 }
 #else
 DataHeader::DataHeader() :
     key_digest(Kvdb_Digest()), data_size(0), data_offset(0),
-            next_header_offset(0) {
+            next_header_offset(0), seq_num(0) {
 }
 #endif
 
 #ifdef WITH_ITERATOR
 DataHeader::DataHeader(const Kvdb_Digest &digest, uint16_t key_len, uint16_t data_len,
-                       uint32_t offset, uint32_t next_offset) :
+                       uint32_t offset, uint32_t next_offset, uint64_t seq) :
     key_digest(digest), key_size(key_len), data_size(data_len), data_offset(offset),
-            next_header_offset(next_offset) {
+            next_header_offset(next_offset), seq_num(seq) {
 }
 #else
 DataHeader::DataHeader(const Kvdb_Digest &digest, uint16_t size,
-                        uint32_t offset, uint32_t next_offset) :
+                        uint32_t offset, uint32_t next_offset, uint64_t seq) :
     key_digest(digest), data_size(size), data_offset(offset),
-            next_header_offset(next_offset) {
+            next_header_offset(next_offset), seq_num(seq) {
 }
 #endif
 
@@ -80,40 +85,15 @@ void HashEntryOnDisk::SetKeyDigest(const Kvdb_Digest& digest) {
 }
 
 HashEntry::HashEntry() :
-    cachePtr_(NULL) {
-    stampPtr_ = new LogicStamp;
-    entryPtr_ = new HashEntryOnDisk;
+    entry_() {
 }
 
-HashEntry::HashEntry(HashEntryOnDisk& entry_ondisk, KVTime time_stamp,
-                     void* read_ptr) :
-    cachePtr_(read_ptr) {
-    stampPtr_ = new LogicStamp(time_stamp, 0);
-    entryPtr_ = new HashEntryOnDisk(entry_ondisk);
+HashEntry::HashEntry(HashEntryOnDisk& entry_ondisk) :
+    entry_(entry_ondisk) {
 }
 
-HashEntry::HashEntry(DataHeader& data_header, uint64_t header_offset,
-                     void* read_ptr) {
-    stampPtr_ = new LogicStamp;
-    entryPtr_ = new HashEntryOnDisk(data_header, header_offset);
-    cachePtr_ = read_ptr;
-}
-
-HashEntry::HashEntry(const HashEntry& toBeCopied) {
-    entryPtr_ = new HashEntryOnDisk(*toBeCopied.entryPtr_);
-    stampPtr_ = new LogicStamp(*toBeCopied.stampPtr_);
-    cachePtr_ = toBeCopied.cachePtr_;
-}
-
-HashEntry::~HashEntry() {
-    cachePtr_ = NULL;
-    if (entryPtr_) {
-        delete entryPtr_;
-    }
-    if (stampPtr_) {
-        delete stampPtr_;
-    }
-    return;
+HashEntry::HashEntry(DataHeader& data_header, uint64_t header_offset) :
+    entry_(data_header, header_offset) {
 }
 
 bool HashEntry::operator==(const HashEntry& toBeCompare) const {
@@ -123,28 +103,55 @@ bool HashEntry::operator==(const HashEntry& toBeCompare) const {
     return false;
 }
 
-HashEntry& HashEntry::operator=(const HashEntry& toBeCopied) {
-    *entryPtr_ = *toBeCopied.entryPtr_;
-    *stampPtr_ = *toBeCopied.stampPtr_;
-    cachePtr_ = toBeCopied.cachePtr_;
-    return *this;
+void HashEntry::SetKeyDigest(const Kvdb_Digest& digest) {
+    entry_.SetKeyDigest(digest);
 }
 
-void HashEntry::SetKeyDigest(const Kvdb_Digest& digest) {
-    entryPtr_->SetKeyDigest(digest);
+LeanEntry::LeanEntry() :
+    hash_(0), dataSize_(0), offsetHi_(0), offsetLo_(0) {
+}
+
+LeanEntry::LeanEntry(const HashEntry& entry) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    uint64_t offset = entry.GetHeaderOffsetPhy();
+    hash_ = KeyDigestHandle::Hash(&digest);
+    dataSize_ = entry.GetDataSize();
+    offsetHi_ = offset >> 32;
+    offsetLo_ = (uint32_t) offset;
 }
 
-void HashEntry::SetLogicStamp(KVTime seg_time, int32_t seg_key_no) {
-    stampPtr_->Set(seg_time, seg_key_no);
+HashEntry LeanEntry::ToEntry(uint16_t tag) const {
+    Kvdb_Digest digest = KeyDigestHandle::Fingerprint(hash_, tag);
+#ifdef WITH_ITERATOR
+    DataHeader header(digest, 0, dataSize_, 0, 0, 0);
+#else
+    DataHeader header(digest, dataSize_, 0, 0, 0);
+#endif
+    return HashEntry(header, GetHeaderOffsetPhy());
 }
 
 bool IndexManager::InitIndexForCreateDB(uint64_t offset, uint32_t numObjects) {
     htSize_ = ComputeHashSizeForPower2(numObjects);
     keyCounter_ = 0;
     startOff_ = offset;
+    indexOff_ = offset;
+    indexSegNum_ = 0;
+
+    //Start above what a former DB on this device could have reached, so
+    //recovery never takes its leftover segments for ours
+    seqNum_.store((uint64_t) KVTime::GetNow() << 20);
 
+    lean_ = options_.index_mode == INDEX_MODE_LEAN;
+    paged_ = options_.index_mode == INDEX_MODE_PAGED;
     initHashTable(htSize_);
 
+    //nothing is committed on device yet, the first checkpoint is full
+    uint32_t range_num = computeRangeNum(htSize_);
+    rangeCopy_.assign(range_num, 1);
+    loadGen_ = 0;
+    clearDirtyRanges(range_num);
+    needFull_ = true;
+
     //Update data theory size from superblock
     dataTheorySize_ = 0;
 
@@ -155,20 +162,37 @@ bool IndexManager::LoadIndexFromDevice(uint64_t offset, uint32_t ht_size) {
     htSize_ = ht_size;
     startOff_ = offset;
 
-    int64_t timeLength = KVTime::SizeOf();
-    if (!rebuildTime(offset)) {
-        return false;
-    } __DEBUG("Load Hashtable timestamp: %s", KVTime::ToChar(*lastTime_));
-    offset += timeLength;
+    //the index may be relocated to data segments by a former checkpoint
+    indexSegNum_ = sbMgr_->GetIndexSegNum();
+    indexOff_ = indexSegNum_ ? sbMgr_->GetIndexOffset() : offset;
+
+    seqNum_.store(sbMgr_->GetNextSeqNum());
+    __DEBUG("Load Hashtable sequence number: %lu", seqNum_.load());
+
+    lean_ = sbMgr_->GetIndexMode() == INDEX_MODE_LEAN;
+    paged_ = sbMgr_->GetIndexMode() == INDEX_MODE_PAGED;
 
-    if (!rebuildHashTable(offset)) {
+    if (!rebuildHashTable(indexOff_)) {
         return false;
     } __DEBUG("Rebuild Hashtable Success");
 
+    uint32_t range_num = computeRangeNum(htSize_);
+    clearDirtyRanges(range_num);
+    needFull_ = false;
+
+    //a checkpoint taken while running counts keys that may have changed
+    //since, keep what the loaded ranges add up to
+    if (!sbMgr_->IsCleanShutdown()) {
+        return true;
+    }
+
     //Update data theory size from superblock
     dataTheorySize_ = sbMgr_->GetDataTheorySize();
     uint32_t key_num = sbMgr_->GetElementNum();
-    if (key_num != keyCounter_) {
+    if (paged_) {
+        //the ranges were not read
+        keyCounter_ = key_num;
+    } else if (key_num != keyCounter_) {
         __ERROR("The Key Number is conflit between superblock and index!!!!!");
         return false;
     }
@@ -176,81 +200,590 @@ bool IndexManager::LoadIndexFromDevice(uint64_t offset, uint32_t ht_size) {
     return true;
 }
 
-bool IndexManager::rebuildTime(uint64_t offset) {
-    int64_t timeLength = KVTime::SizeOf();
-    time_t _time;
-    if (bdev_->pRead(&_time, timeLength, offset) != timeLength) {
-        __ERROR("Error in reading timestamp from file\n");
+bool IndexManager::WriteIndexToDevice(uint64_t gen, bool full) {
+    if (!table_) {
+        __ERROR("The index is not initialized!");
         return false;
     }
-    lastTime_->SetTime(_time);
-    return true;
+    //segments from applied_seq on are replayed by recovery
+    uint64_t applied_seq = GetAppliedSeqNum();
+    uint64_t next_seq = seqNum_.load();
+
+    //a range with more entries than its block holds grows the layout,
+    //then the checkpoint is tried again
+    for (int retry = 0; retry < 3; retry++) {
+        //a paged layout not committed yet is committed as it is
+        uint32_t ht_size = chooseHTSize(GetKeyCounter());
+        if (ht_size != htSize_ && !(paged_ && ckptRelocated_)
+                && !switchLayout(ht_size, gen)) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> meta_lck(mtx_);
+        lockStripes();
+        ckptFull_ = full || needFull_ || ckptRelocated_;
+        ckptGen_ = gen;
+        uint32_t range_num = computeRangeNum(htSize_);
+        //a paged layout changed by this checkpoint has every range written,
+        //changes since are left to the next one
+        if (!(paged_ && ckptRelocated_ && loadGen_ == gen)) {
+            for (uint32_t i = 0; i < range_num; i++) {
+                if (ckptFull_ || dirtyRanges_[i]) {
+                    ckptRanges_.push_back(i);
+                }
+            }
+            clearDirtyRanges(range_num);
+        }
+        uint32_t key_num = sumKeyCounter();
+        uint64_t data_size = sumDataTheorySize();
+        unlockStripes();
+        meta_lck.unlock();
+
+        char *buf;
+        if (posix_memalign((void **) &buf, 4096, INDEX_BLOCK_SIZE)) {
+            AbortCheckpoint();
+            return false;
+        }
+        bool ret = true;
+        for (vector<uint32_t>::iterator iter = ckptRanges_.begin();
+                iter != ckptRanges_.end() && ret; iter++) {
+            vector<HashEntry> entries;
+            uint64_t version = 0;
+            if (paged_) {
+                ret = pagedTable_->Snapshot(*iter, entries, version);
+                if (!ret) {
+                    break;
+                }
+                ckptVersions_.push_back(version);
+            } else {
+                collectRange(*iter, entries);
+            }
+            if (!encodeRange(*iter, entries, gen, buf)) {
+                __WARN("Index range %u has %lu entries, grow the index on device", *iter, entries.size());
+                overflow_ = true;
+                break;
+            }
+            //the committed block stays intact until the superblock moves on
+            ret = writeDataToDevice(buf, INDEX_BLOCK_SIZE,
+                                    rangeOffset(*iter, rangeCopy_[*iter] ^ 1));
+        }
+        free(buf);
+
+        if (!ret || overflow_) {
+            AbortCheckpoint();
+            if (!ret) {
+                return false;
+            }
+            continue;
+        }
+        __DEBUG("Write %lu index ranges for checkpoint %lu", ckptRanges_.size(), gen);
+
+        sbMgr_->SetIndexLocation(indexSegNum_ ? indexOff_ : 0, indexSegNum_);
+        sbMgr_->SetHTSize(htSize_);
+
+        //Update data theory size to superblock
+        sbMgr_->SetDataTheorySize(data_size);
+        sbMgr_->SetElementNum(key_num);
+        sbMgr_->SetCheckpointSeqNum(applied_seq, next_seq);
+        return true;
+    }
+    __ERROR("Could not fit the index ranges to device");
+    return false;
+}
+
+void IndexManager::CommitCheckpoint() {
+    for (vector<uint32_t>::iterator iter = ckptRanges_.begin();
+            iter != ckptRanges_.end(); iter++) {
+        rangeCopy_[*iter] ^= 1;
+    }
+
+    //written pages may go now, they are read back at the committed gen
+    if (paged_) {
+        mtx_.lock();
+        loadGen_ = ckptGen_;
+        mtx_.unlock();
+        for (uint32_t i = 0; i < ckptVersions_.size(); i++) {
+            pagedTable_->SetClean(ckptRanges_[i], ckptVersions_[i]);
+        }
+        ckptVersions_.clear();
+    }
+
+    //release the segments of the former relocated index
+    if (ckptRelocated_ && oldIndexSegNum_) {
+        uint32_t old_seg_id;
+        if (segMgr_->ComputeSegIdFromOffset(oldIndexOff_, old_seg_id)) {
+            segMgr_->FreeForIndex(old_seg_id, oldIndexSegNum_);
+        }
+    }
+    if (ckptFull_) {
+        needFull_ = false;
+    }
+    ckptRanges_.clear();
+    ckptRelocated_ = false;
+}
+
+void IndexManager::AbortCheckpoint() {
+    ckptVersions_.clear();
+    if (ckptRelocated_ && paged_) {
+        //the pages of the old layout are gone, the new one is kept for the
+        //next checkpoint, the old index segments are freed once it commits
+        ckptRanges_.clear();
+        return;
+    }
+    if (ckptRelocated_) {
+        if (indexSegNum_) {
+            uint32_t first_seg_id;
+            if (segMgr_->ComputeSegIdFromOffset(indexOff_, first_seg_id)) {
+                segMgr_->FreeForIndex(first_seg_id, indexSegNum_);
+            }
+        }
+
+        std::lock_guard<std::mutex> l(mtx_);
+        indexOff_ = oldIndexOff_;
+        indexSegNum_ = oldIndexSegNum_;
+        rangeCopy_.swap(oldRangeCopy_);
+        //changes since were marked on the new layout, write all ranges
+        lockStripes();
+        htSize_ = oldHtSize_;
+        clearDirtyRanges(computeRangeNum(htSize_));
+        unlockStripes();
+        needFull_ = true;
+    } else {
+        std::lock_guard<std::mutex> l(mtx_);
+        for (vector<uint32_t>::iterator iter = ckptRanges_.begin();
+                iter != ckptRanges_.end(); iter++) {
+            std::lock_guard<std::mutex> stripe_lck(rangeStripe(*iter).mtx);
+            markRangeDirty(*iter);
+        }
+    }
+    ckptRanges_.clear();
+    ckptRelocated_ = false;
+}
+
+uint32_t IndexManager::GetDirtyRangeNum() const {
+    std::lock_guard<std::mutex> l(mtx_);
+    lockStripes();
+    uint32_t dirty_num = 0;
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        dirty_num += stripes_[i].dirtyNum;
+    }
+    unlockStripes();
+    return dirty_num + (needFull_ ? 1 : 0);
+}
+
+uint32_t IndexManager::chooseHTSize(uint32_t key_num) const {
+    uint32_t region_ht_size = computeRegionHTSize();
+    uint32_t ht_size = htSize_;
+    if (overflow_) {
+        ht_size <<= 1;
+    } else if (ht_size > region_ht_size && key_num <= region_ht_size / 2) {
+        //back to the index region, with room to not bounce out again
+        ht_size = region_ht_size;
+    }
+    if (key_num > ht_size) {
+        ht_size = ComputeHashSizeForPower2(key_num);
+    }
+    return std::max(ht_size, region_ht_size);
 }
 
-bool IndexManager::WriteIndexToDevice() {
+bool IndexManager::switchLayout(uint32_t ht_size, uint64_t gen) {
+    //the device layout keeps one entry per slot on average, relocate the
+    //index to data segments once the keys outgrow the index region. The
+    //paged index reads the old layout while writing the new one, so they
+    //may not share the region
     uint64_t offset = startOff_;
+    uint32_t seg_num = 0;
+    uint32_t first_seg_id = 0;
+    if (ht_size > computeRegionHTSize() || (paged_ && !indexSegNum_)) {
+        uint64_t index_size = ComputeIndexSizeOnDevice(ht_size);
+        uint32_t seg_size = segMgr_->GetSegmentSize();
+        seg_num = (index_size + seg_size - 1) / seg_size;
+        if (!segMgr_->AllocForIndex(seg_num, first_seg_id)) {
+            __ERROR("Not enough free segments to relocate index, need %u", seg_num);
+            return false;
+        }
+        segMgr_->ComputeSegOffsetFromId(first_seg_id, offset);
+        __DEBUG("Relocate index to %u segments from seg_id = %u", seg_num, first_seg_id);
+    }
 
-    int64_t timeLength = KVTime::SizeOf();
-    if (!persistTime(offset)) {
-        return false;
-    } __DEBUG("Write Hashtable timestamp: %s", KVTime::ToChar(*lastTime_));
-    offset += timeLength;
+    //the paged index has the old layout on device, it is rewritten in the
+    //new one with every key locked
+    if (paged_) {
+        pagedTable_->LockAll();
+        if (!rehashPages(ht_size, offset, gen)) {
+            pagedTable_->UnlockAll();
+            if (seg_num) {
+                segMgr_->FreeForIndex(first_seg_id, seg_num);
+            }
+            return false;
+        }
+    }
+
+    std::unique_lock<std::mutex> l(mtx_);
+    oldHtSize_ = htSize_;
+    oldIndexOff_ = indexOff_;
+    oldIndexSegNum_ = indexSegNum_;
+    oldRangeCopy_.swap(rangeCopy_);
+
+    //updates take the stripe of their range in this layout
+    lockStripes();
+    htSize_ = ht_size;
+    uint32_t range_num = computeRangeNum(htSize_);
+    clearDirtyRanges(range_num);
+    unlockStripes();
+    indexOff_ = offset;
+    indexSegNum_ = seg_num;
+    //blocks there are left from former layouts, all ranges are written.
+    //rehashPages already wrote copy 0 of the paged ones
+    rangeCopy_.assign(range_num, paged_ ? 0 : 1);
+    ckptRelocated_ = true;
+    overflow_ = false;
+    if (paged_) {
+        loadGen_ = gen;
+        l.unlock();
+        pagedTable_->Clear();
+        pagedTable_->UnlockAll();
+    }
+    return true;
+}
+
+bool IndexManager::rehashPages(uint32_t ht_size, uint64_t offset, uint64_t gen) {
+    uint32_t old_slot_num = rangeSlotNum(htSize_);
+    uint32_t slot_num = rangeSlotNum(ht_size);
+    uint32_t range_num = computeRangeNum(ht_size);
 
-    if (!persistHashTable(offset)) {
+    char *buf;
+    if (posix_memalign((void **) &buf, 4096, INDEX_BLOCK_SIZE)) {
         return false;
-    } __DEBUG("Persist Hashtable Success");
+    }
+    bool ret = true;
+    for (uint32_t no = 0; no < range_num && ret; no++) {
+        //old ranges of the slots which map to range no
+        std::set<uint32_t> old_ranges;
+        uint32_t first_slot = no * slot_num;
+        uint32_t last_slot = std::min(first_slot + slot_num, ht_size);
+        for (uint32_t slot = first_slot; slot < last_slot; slot++) {
+            if (ht_size >= htSize_) {
+                old_ranges.insert((slot & (htSize_ - 1)) / old_slot_num);
+                continue;
+            }
+            for (uint32_t old_slot = slot; old_slot < htSize_; old_slot += ht_size) {
+                old_ranges.insert(old_slot / old_slot_num);
+            }
+        }
 
-    //Update data theory size to superblock
-    sbMgr_->SetDataTheorySize(dataTheorySize_);
-    sbMgr_->SetElementNum(keyCounter_);
+        vector<HashEntry> entries;
+        for (std::set<uint32_t>::iterator iter = old_ranges.begin();
+                iter != old_ranges.end() && ret; iter++) {
+            vector<HashEntry> old_entries;
+            uint64_t version;
+            ret = pagedTable_->Snapshot(*iter, old_entries, version);
+            for (vector<HashEntry>::iterator e_iter = old_entries.begin();
+                    e_iter != old_entries.end(); e_iter++) {
+                Kvdb_Digest digest = e_iter->GetKeyDigest();
+                if ((KeyDigestHandle::Hash(&digest) & (ht_size - 1)) / slot_num == no) {
+                    entries.push_back(*e_iter);
+                }
+            }
+        }
+        if (!ret) {
+            break;
+        }
+        if (!encodeRange(no, entries, gen, buf)) {
+            __ERROR("Index range %u of the new layout has %lu entries", no, entries.size());
+            ret = false;
+            break;
+        }
+        //the new layout writes copy 0 first, see switchLayout
+        ret = writeDataToDevice(buf, INDEX_BLOCK_SIZE,
+                                offset + (uint64_t) no * 2 * INDEX_BLOCK_SIZE);
+    }
+    free(buf);
+    return ret;
+}
 
+void IndexManager::collectRange(uint32_t range_no, vector<HashEntry>& entries) {
+    uint32_t slot_num = rangeSlotNum(htSize_);
+    uint32_t first_slot = range_no * slot_num;
+
+    //a resize in between moves entries across buckets, walk again
+    vector<HashEntry> bucket_entries;
+    uint32_t resize_num;
+    do {
+        bucket_entries.clear();
+        resize_num = table_->GetResizeNum();
+        uint32_t bucket_num = table_->GetBucketNum();
+        if (bucket_num >= htSize_) {
+            //a slot holds the buckets with the same low bits
+            for (uint32_t slot = first_slot; slot < first_slot + slot_num; slot++) {
+                for (uint32_t no = slot; no < bucket_num; no += htSize_) {
+                    table_->GetEntries(no, bucket_entries);
+                }
+            }
+        } else {
+            //slots of the range share buckets
+            uint32_t num = std::min(slot_num, bucket_num);
+            for (uint32_t i = 0; i < num; i++) {
+                table_->GetEntries((first_slot + i) & (bucket_num - 1),
+                                   bucket_entries);
+            }
+        }
+    } while (table_->GetResizeNum() != resize_num);
+
+    for (vector<HashEntry>::iterator iter = bucket_entries.begin();
+            iter != bucket_entries.end(); iter++) {
+        Kvdb_Digest digest = iter->GetKeyDigest();
+        if (computeSlotNo(&digest) / slot_num == range_no) {
+            entries.push_back(*iter);
+        }
+    }
+}
+
+bool IndexManager::encodeRange(uint32_t range_no, vector<HashEntry>& entries,
+                               uint64_t gen, char* buf) {
+    memset(buf, 0, INDEX_BLOCK_SIZE);
+    IndexBlockHeader *header = (IndexBlockHeader *) buf;
+    header->range_no = range_no;
+    header->gen = gen;
+    header->entry_num = entries.size();
+    header->format = lean_ ? INDEX_BLOCK_FORMAT_LEAN : INDEX_BLOCK_FORMAT;
+
+    //records near each other on device differ in a few low bytes
+    std::sort(entries.begin(), entries.end(),
+              [](const HashEntry& a, const HashEntry& b) {
+                  return a.GetHeaderOffsetPhy() < b.GetHeaderOffsetPhy();
+              });
+    if (lean_) {
+        if (!encodeLeanRange(entries, buf)) {
+            return false;
+        }
+        header->checksum = KVCrc::Crc32c(0, buf, INDEX_BLOCK_SIZE);
+        return true;
+    }
+    uint64_t base_seq = 0;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        if (i == 0 || entries[i].GetSeqNum() < base_seq) {
+            base_seq = entries[i].GetSeqNum();
+        }
+    }
+
+    char *data = &buf[sizeof(IndexBlockHeader)];
+    uint32_t size = blockDataSize();
+    uint32_t pos = KVVarint::Encode(base_seq, data);
+    uint64_t last_offset = 0;
+    size_t digest_size = KeyDigestHandle::SizeOfDigest();
+    char field[KVVarint::MaxSize * 6];
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        int len = 0;
+        len += KVVarint::Encode(iter->GetHeaderOffsetPhy() - last_offset, &field[len]);
+        len += KVVarint::Encode(iter->GetSeqNum() - base_seq, &field[len]);
+#ifdef WITH_ITERATOR
+        len += KVVarint::Encode(iter->GetKeySize(), &field[len]);
+#endif
+        len += KVVarint::Encode(iter->GetDataSize(), &field[len]);
+        len += KVVarint::Encode(iter->GetDataOffsetInSeg(), &field[len]);
+        //0 unless the data is aligned at the segment tail
+        int64_t next_gap = (int64_t) iter->GetNextHeadOffsetInSeg()
+                - iter->GetDataOffsetInSeg() - iter->GetDataSize();
+        len += KVVarint::Encode(KVVarint::ZigZag(next_gap), &field[len]);
+
+        if (pos + digest_size + len > size) {
+            return false;
+        }
+        Kvdb_Digest digest = iter->GetKeyDigest();
+        memcpy(&data[pos], digest.GetDigest(), digest_size);
+        pos += digest_size;
+        memcpy(&data[pos], field, len);
+        pos += len;
+        last_offset = iter->GetHeaderOffsetPhy();
+    }
+    header->length = pos;
+    header->checksum = KVCrc::Crc32c(0, buf, INDEX_BLOCK_SIZE);
+    return true;
+}
+
+bool IndexManager::encodeLeanRange(vector<HashEntry>& entries, char* buf) {
+    IndexBlockHeader *header = (IndexBlockHeader *) buf;
+    char *data = &buf[sizeof(IndexBlockHeader)];
+    uint32_t size = blockDataSize();
+    uint32_t pos = 0;
+    uint64_t last_offset = 0;
+    char field[KVVarint::MaxSize * 2];
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        int len = 0;
+        len += KVVarint::Encode(iter->GetHeaderOffsetPhy() - last_offset, &field[len]);
+        len += KVVarint::Encode(iter->GetDataSize(), &field[len]);
+
+        Kvdb_Digest digest = iter->GetKeyDigest();
+        uint32_t hash = KeyDigestHandle::Hash(&digest);
+        uint16_t tag = KeyDigestHandle::Tag(&digest);
+        if (pos + sizeof(hash) + sizeof(tag) + len > size) {
+            return false;
+        }
+        memcpy(&data[pos], &hash, sizeof(hash));
+        pos += sizeof(hash);
+        memcpy(&data[pos], &tag, sizeof(tag));
+        pos += sizeof(tag);
+        memcpy(&data[pos], field, len);
+        pos += len;
+        last_offset = iter->GetHeaderOffsetPhy();
+    }
+    header->length = pos;
+    return true;
+}
+
+bool IndexManager::decodeLeanBlock(char* block, vector<HashEntry>& entries) {
+    IndexBlockHeader *header = (IndexBlockHeader *) block;
+    const char *data = &block[sizeof(IndexBlockHeader)];
+    uint32_t size = header->length;
+
+    uint32_t pos = 0;
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < header->entry_num; i++) {
+        uint32_t hash;
+        uint16_t tag;
+        if (pos + sizeof(hash) + sizeof(tag) > size) {
+            return false;
+        }
+        memcpy(&hash, &data[pos], sizeof(hash));
+        pos += sizeof(hash);
+        memcpy(&tag, &data[pos], sizeof(tag));
+        pos += sizeof(tag);
+
+        //offset delta, data size
+        uint64_t field[2];
+        for (int f = 0; f < 2; f++) {
+            int len = KVVarint::Decode(&data[pos], size - pos, field[f]);
+            if (!len) {
+                return false;
+            }
+            pos += len;
+        }
+        offset += field[0];
+
+        Kvdb_Digest digest = KeyDigestHandle::Fingerprint(hash, tag);
+#ifdef WITH_ITERATOR
+        DataHeader data_header(digest, 0, field[1], 0, 0, 0);
+#else
+        DataHeader data_header(digest, field[1], 0, 0, 0);
+#endif
+        entries.push_back(HashEntry(data_header, offset));
+    }
     return true;
 }
 
-bool IndexManager::persistTime(uint64_t offset) {
-    int64_t timeLength = KVTime::SizeOf();
-    lastTime_->Update();
-    time_t _time = lastTime_->GetTime();
+bool IndexManager::decodeBlock(char* block, vector<HashEntry>& entries) {
+    IndexBlockHeader *header = (IndexBlockHeader *) block;
+    if (header->format == INDEX_BLOCK_FORMAT_LEAN) {
+        return decodeLeanBlock(block, entries);
+    }
+    const char *data = &block[sizeof(IndexBlockHeader)];
+    uint32_t size = header->length;
+    size_t digest_size = KeyDigestHandle::SizeOfDigest();
 
-    if (bdev_->pWrite((void *) &_time, timeLength, offset) != timeLength) {
-        __ERROR("Error write timestamp to file\n");
+    uint64_t base_seq;
+    uint32_t pos = KVVarint::Decode(data, size, base_seq);
+    if (!pos) {
         return false;
     }
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < header->entry_num; i++) {
+        if (pos + digest_size > size) {
+            return false;
+        }
+        Kvdb_Digest digest;
+        digest.SetDigest((unsigned char *) &data[pos], digest_size);
+        pos += digest_size;
+
+        //offset delta, seq delta, [key size,] data size, data offset, gap
+#ifdef WITH_ITERATOR
+        const int field_num = 6;
+#else
+        const int field_num = 5;
+#endif
+        uint64_t field[field_num];
+        for (int f = 0; f < field_num; f++) {
+            int len = KVVarint::Decode(&data[pos], size - pos, field[f]);
+            if (!len) {
+                return false;
+            }
+            pos += len;
+        }
+        int f = 0;
+        offset += field[f++];
+        uint64_t seq_num = base_seq + field[f++];
+#ifdef WITH_ITERATOR
+        uint16_t key_size = field[f++];
+#endif
+        uint16_t data_size = field[f++];
+        uint32_t data_offset = field[f++];
+        uint32_t next_offset = data_offset + data_size
+                + KVVarint::UnZigZag(field[f++]);
+
+#ifdef WITH_ITERATOR
+        DataHeader data_header(digest, key_size, data_size, data_offset,
+                               next_offset, seq_num);
+#else
+        DataHeader data_header(digest, data_size, data_offset, next_offset,
+                               seq_num);
+#endif
+        entries.push_back(HashEntry(data_header, offset));
+    }
     return true;
 }
 
-bool IndexManager::UpdateIndex(KVSlice* slice) {
-    const Kvdb_Digest *digest = &slice->GetDigest();
+uint32_t IndexManager::computeRegionHTSize() const {
+    uint64_t region_size = sbMgr_->GetIndexSize();
+    uint32_t ht_size = 1;
+    while (ht_size < (1U << 31)
+            && ComputeIndexSizeOnDevice(ht_size << 1) <= region_size) {
+        ht_size <<= 1;
+    }
+    return ht_size;
+}
 
+bool IndexManager::UpdateIndex(KVSlice* slice) {
     HashEntry entry = slice->GetHashEntry();
-    const char* data = slice->GetData();
+    return updateIndex(entry, slice->GetData() != NULL);
+}
+
+bool IndexManager::UpdateIndex(HashEntry& entry) {
+    return updateIndex(entry, entry.GetDataSize() != 0);
+}
+
+bool IndexManager::updateIndex(HashEntry& entry, bool is_insert) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
 
-    uint32_t hash_index = KeyDigestHandle::Hash(digest) % htSize_;
+    table_->MigrateStep();
 
-    std::unique_lock<std::mutex> meta_lck(mtx_, std::defer_lock);
+    //the lean mode reads the candidate headers before the lock, so other
+    //keys of the lock don't wait for the I/O
+    vector<HashEntry> read;
+    uint64_t gc_freed = 0;
+    if (lean_) {
+        gc_freed = segMgr_->GetGCFreedSegs();
+        readLeanHeaders(digest, read);
+    }
 
-    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
-    LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
+    std::unique_lock<std::mutex> l(table_->GetLock(digest));
 
-    bool is_exist = entry_list->search(entry);
-    if (!is_exist) {
-        if (data) {
+    //a segment GC freed since may hold other records now
+    bool read_valid = lean_ && segMgr_->GetGCFreedSegs() == gc_freed;
+    HashEntry entry_inMem;
+    if (!getLocked(digest, entry_inMem, NULL, read_valid ? &read : NULL)) {
+        if (is_insert) {
             //It's insert a new entry operation
-            meta_lck.lock();
-            if (keyCounter_ == htSize_) {
-                __WARN("UpdateIndex Failed, because the hashtable is full!");
-                return false;
-            }
-            meta_lck.unlock();
+            putLocked(entry, NULL);
 
-            entry_list->put(entry);
+            uint32_t key_num = updateMeta(digest, 1,
+                                          SizeOfDataHeader() + entry.GetDataSize());
+            l.unlock();
 
-            meta_lck.lock();
-            keyCounter_++;
-            dataTheorySize_ += SizeOfDataHeader() + slice->GetDataLen();
-            meta_lck.unlock();
+            table_->CheckResize(key_num);
 
-            __DEBUG("UpdateIndex request, because this entry is not exist! Now dataTheorySize_ is %ld", dataTheorySize_);
+            __DEBUG("UpdateIndex request, because this entry is not exist! Now dataTheorySize_ is %ld", dataTheorySize_.load());
         }
         else {
             //It's a invalid delete operation
@@ -259,136 +792,369 @@ bool IndexManager::UpdateIndex(KVSlice* slice) {
         }
     }
     else {
-        HashEntry *entry_inMem = entry_list->getRef(entry);
-        HashEntry::LogicStamp *lts = entry.GetLogicStamp();
-        HashEntry::LogicStamp *lts_inMem = entry_inMem->GetLogicStamp();
-
-        if ( *lts < *lts_inMem) {
+        if (entry.GetSeqNum() < entry_inMem.GetSeqNum()) {
             segMgr_->ModifyDeathEntry(entry);
             __DEBUG("Ignore the UpdateIndex request, because request is expired!");
         }
         else {
             //this operation is need to do
-            segMgr_->ModifyDeathEntry(*entry_inMem);
+            segMgr_->ModifyDeathEntry(entry_inMem);
 
             uint16_t data_size = entry.GetDataSize() ;
-            uint16_t data_inMem_size = entry_inMem->GetDataSize();
+            uint16_t data_inMem_size = entry_inMem.GetDataSize();
+
+            putLocked(entry, &entry_inMem);
 
-            meta_lck.lock();
+            //mark the range after the change, so a checkpoint clearing
+            //the mark in between has seen it
             if (data_size == 0) {
-                dataTheorySize_ -= (uint64_t)(SizeOfDataHeader() + data_inMem_size);
+                updateMeta(digest, 0, -(int64_t)(SizeOfDataHeader() + data_inMem_size));
             }
             else {
-                dataTheorySize_ += ( data_size > data_inMem_size? 
-                        ((uint64_t)(data_size - data_inMem_size)) : 
-                        -((uint64_t)(data_inMem_size - data_size)) );
+                updateMeta(digest, 0, (int64_t) data_size - data_inMem_size);
             }
-            meta_lck.unlock();
 
-            entry_list->put(entry);
-
-            __DEBUG("UpdateIndex request, because request is new than in memory!Now dataTheorySize_ is %ld", dataTheorySize_);
+            __DEBUG("UpdateIndex request, because request is new than in memory!Now dataTheorySize_ is %ld", dataTheorySize_.load());
         }
         return true;
     }
 
-    __DEBUG("Update Index: key:%s, data_len:%u, seg_id:%u, data_offset:%u",
-            slice->GetKeyStr().c_str(), slice->GetDataLen(),
-            slice->GetSegId(), slice->GetHashEntry().GetDataOffsetInSeg());
+    __DEBUG("Update Index: data_len:%u, header_offset:%lu, data_offset:%u",
+            entry.GetDataSize(), entry.GetHeaderOffsetPhy(),
+            entry.GetDataOffsetInSeg());
 
     return true;
 }
 
-void IndexManager::UpdateIndexes(list<KVSlice*> &slice_list) {
-    std::lock_guard<std::mutex> l(batch_mtx_);
-    for (list<KVSlice *>::iterator iter = slice_list.begin(); iter
+void IndexManager::UpdateIndexes(vector<KVSlice*> &slice_list) {
+    if (nodeThds_.empty()) {
+        std::lock_guard<std::mutex> l(batch_mtx_);
+        for (vector<KVSlice *>::iterator iter = slice_list.begin(); iter
+                != slice_list.end(); iter++) {
+            KVSlice *slice = *iter;
+            UpdateIndex(slice);
+        } __DEBUG("UpdateToIndex Success!");
+        return;
+    }
+
+    //a key is always in the same partition, so its updates keep their
+    //order. Batches don't serialize here, the node workers take the
+    //bucket locks of each key and the later sequence number wins
+    IndexBatch batch;
+    batch.parts.resize(numaNodes_);
+    for (vector<KVSlice *>::iterator iter = slice_list.begin(); iter
             != slice_list.end(); iter++) {
         KVSlice *slice = *iter;
-        UpdateIndex(slice);
-    } __DEBUG("UpdateToIndex Success!");
+        batch.parts[table_->GetNode(slice->GetDigest())].push_back(slice);
+    }
+    batch.pending = 0;
+    for (uint32_t i = 0; i < numaNodes_; i++) {
+        if (!batch.parts[i].empty()) {
+            batch.pending++;
+        }
+    }
+    for (uint32_t i = 0; i < numaNodes_; i++) {
+        if (!batch.parts[i].empty()) {
+            nodeQues_[i]->Enqueue_Notify(&batch);
+        }
+    }
+    std::unique_lock<std::mutex> bl(batch.mtx);
+    batch.cv.wait(bl, [&batch] { return batch.pending == 0; });
+    __DEBUG("UpdateToIndex Success by %u partitions!", numaNodes_);
+}
+
+void IndexManager::startNodeThds() {
+    numaNodes_ = 1;
+    if (paged_) {
+        return;
+    }
+    while ((numaNodes_ << 1) <= (uint32_t) std::max(options_.index_numa_nodes, 0)
+            && numaNodes_ < (1U << 16)) {
+        numaNodes_ <<= 1;
+    }
+    if (numaNodes_ == 1) {
+        return;
+    }
+    nodeThdStop_.store(false);
+    for (uint32_t i = 0; i < numaNodes_; i++) {
+        nodeQues_.push_back(new WorkQueue<IndexBatch*>);
+    }
+    for (uint32_t i = 0; i < numaNodes_; i++) {
+        nodeThds_.push_back(std::thread(&IndexManager::nodeThdEntry, this, i));
+    }
+    __INFO("Index is partitioned for %u NUMA nodes on a host of %d",
+           numaNodes_, KVNuma::NodeNum());
+}
+
+void IndexManager::stopNodeThds() {
+    nodeThdStop_.store(true);
+    for (auto &th : nodeThds_) {
+        th.join();
+    }
+    nodeThds_.clear();
+    for (uint32_t i = 0; i < nodeQues_.size(); i++) {
+        delete nodeQues_[i];
+    }
+    nodeQues_.clear();
+}
+
+void IndexManager::nodeThdEntry(uint32_t node) {
+    if (!KVNuma::BindThread(node % KVNuma::NodeNum())) {
+        __DEBUG("Index worker %u is not bound to its node", node);
+    }
+    while (!nodeThdStop_.load()) {
+        IndexBatch *batch = nodeQues_[node]->Wait_Dequeue();
+        if (!batch) {
+            continue;
+        }
+        list<KVSlice*> &part = batch->parts[node];
+        for (list<KVSlice *>::iterator iter = part.begin(); iter
+                != part.end(); iter++) {
+            UpdateIndex(*iter);
+        }
+        std::lock_guard<std::mutex> l(batch->mtx);
+        if (--batch->pending == 0) {
+            batch->cv.notify_one();
+        }
+    }
 }
 
 void IndexManager::RemoveEntry(HashEntry entry) {
     Kvdb_Digest digest = entry.GetKeyDigest();
 
-    uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
+    table_->MigrateStep();
 
-    std::unique_lock<std::mutex> meta_lck(mtx_, std::defer_lock);
-    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
-    LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
+    std::unique_lock<std::mutex> l(table_->GetLock(digest));
 
-    HashEntry *entry_inMem = entry_list->getRef(entry);
-    if (!entry_inMem) {
+    HashEntry entry_inMem;
+    if (!getLocked(digest, entry_inMem, &entry)) {
         __DEBUG("Already remove the index entry");
         return;
     }
-    HashEntry::LogicStamp *lts = entry.GetLogicStamp();
-    HashEntry::LogicStamp *lts_inMem = entry_inMem->GetLogicStamp();
-    KVTime &t = lts->GetSegTime();
-    KVTime &t_inMem = lts_inMem->GetSegTime();
-    if (t_inMem == t && entry_inMem->GetDataSize() == 0) {
-        entry_list->remove(entry);
+    if (entry_inMem.GetSeqNum() == entry.GetSeqNum() && entry_inMem.GetDataSize() == 0) {
+        removeLocked(entry_inMem);
         segMgr_->ModifyDeathEntry(entry);
 
-        meta_lck.lock();
-        keyCounter_--;
-        meta_lck.unlock();
+        uint32_t key_num = updateMeta(digest, -1, 0);
+        l.unlock();
+
+        table_->CheckResize(key_num);
 
         __DEBUG("Remove the index entry!");
     }
 }
 
+void IndexManager::AdvanceSeqNum(uint64_t seq_num) {
+    uint64_t cur = seqNum_.load();
+    while (cur <= seq_num && !seqNum_.compare_exchange_weak(cur, seq_num + 1)) {
+    }
+}
+
+uint64_t IndexManager::NextSegSeqNum() {
+    std::lock_guard<std::mutex> l(seqMtx_);
+    uint64_t seq_num = seqNum_.fetch_add(1);
+    applyingSegs_.insert(seq_num);
+    return seq_num;
+}
+
+void IndexManager::SegApplied(uint64_t seq_num) {
+    std::lock_guard<std::mutex> l(seqMtx_);
+    std::multiset<uint64_t>::iterator iter = applyingSegs_.find(seq_num);
+    if (iter != applyingSegs_.end()) {
+        applyingSegs_.erase(iter);
+    }
+}
+
+uint64_t IndexManager::GetAppliedSeqNum() {
+    std::lock_guard<std::mutex> l(seqMtx_);
+    if (applyingSegs_.empty()) {
+        return seqNum_.load();
+    }
+    return *applyingSegs_.begin();
+}
+
+uint32_t IndexManager::updateMeta(const Kvdb_Digest& digest, int64_t key_delta,
+                                  int64_t size_delta) {
+    //the layout may change until the stripe is locked
+    for (;;) {
+        uint32_t range_no = computeSlotNo(&digest) / rangeSlotNum(htSize_);
+        MetaStripe &stripe = rangeStripe(range_no);
+        std::lock_guard<std::mutex> l(stripe.mtx);
+        if (computeSlotNo(&digest) / rangeSlotNum(htSize_) != range_no) {
+            continue;
+        }
+
+        stripe.keyDelta += key_delta;
+        stripe.sizeDelta += size_delta;
+        markRangeDirty(range_no);
+        if (++stripe.pending >= INDEX_META_FOLD_NUM) {
+            keyCounter_ += (uint32_t) stripe.keyDelta;
+            dataTheorySize_ += (uint64_t) stripe.sizeDelta;
+            stripe.keyDelta = 0;
+            stripe.sizeDelta = 0;
+            stripe.pending = 0;
+        }
+        //other stripes may keep some, enough to resize the table
+        return keyCounter_.load() + (uint32_t) stripe.keyDelta;
+    }
+}
+
+void IndexManager::markRangeDirty(uint32_t range_no) {
+    if (!dirtyRanges_[range_no]) {
+        dirtyRanges_[range_no] = 1;
+        rangeStripe(range_no).dirtyNum++;
+    }
+}
+
+void IndexManager::lockStripes() const {
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        stripes_[i].mtx.lock();
+    }
+}
+
+void IndexManager::unlockStripes() const {
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        stripes_[i].mtx.unlock();
+    }
+}
+
+uint32_t IndexManager::sumKeyCounter() const {
+    uint32_t key_num = keyCounter_.load();
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        key_num += (uint32_t) stripes_[i].keyDelta;
+    }
+    return key_num;
+}
+
+uint64_t IndexManager::sumDataTheorySize() const {
+    uint64_t data_size = dataTheorySize_.load();
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        data_size += (uint64_t) stripes_[i].sizeDelta;
+    }
+    return data_size;
+}
+
+void IndexManager::clearDirtyRanges(uint32_t range_num) {
+    dirtyRanges_.assign(range_num, 0);
+    for (int i = 0; i < INDEX_META_STRIPE_NUM; i++) {
+        stripes_[i].dirtyNum = 0;
+    }
+}
+
+uint32_t IndexManager::DropEntriesInSegs(const vector<bool>& segs) {
+    uint32_t dropped = 0;
+    for (uint32_t no = 0; no < table_->GetBucketNum(); no++) {
+        vector<HashEntry> entries;
+        table_->GetEntries(no, entries);
+        for (vector<HashEntry>::iterator iter = entries.begin();
+                iter != entries.end(); iter++) {
+            uint32_t seg_id;
+            if (segMgr_->ComputeSegIdFromOffset(iter->GetHeaderOffsetPhy(), seg_id)
+                    && seg_id < segs.size() && !segs[seg_id]) {
+                continue;
+            }
+
+            Kvdb_Digest digest = iter->GetKeyDigest();
+            std::unique_lock<std::mutex> l(table_->GetLock(digest));
+            HashEntry entry_inMem;
+            if (!getLocked(digest, entry_inMem, &*iter)
+                    || entry_inMem.GetHeaderOffsetPhy() != iter->GetHeaderOffsetPhy()) {
+                continue;
+            }
+            uint16_t data_size = entry_inMem.GetDataSize();
+            removeLocked(entry_inMem);
+            updateMeta(digest, -1, -(int64_t)(SizeOfDataHeader() + data_size));
+            l.unlock();
+            dropped++;
+        }
+    }
+    __DEBUG("Drop %u index entries in rewritten segments", dropped);
+    return dropped;
+}
+
 bool IndexManager::GetHashEntry(KVSlice *slice) {
     const Kvdb_Digest *digest = &slice->GetDigest();
-    uint32_t hash_index = KeyDigestHandle::Hash(digest) % htSize_;
-    HashEntry entry;
-    entry.SetKeyDigest(*digest);
 
-    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
-    LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
-
-    if (entry_list->search(entry)) {
-        vector<HashEntry> tmp_vec = entry_list->get();
-        for (vector<HashEntry>::iterator iter = tmp_vec.begin(); iter!=tmp_vec.end(); iter++) {
-            if (iter->GetKeyDigest() == *digest) {
-                entry = *iter;
+    if (lean_) {
+        vector<HashEntry> entries;
+        leanTable_->Lookup(*digest, entries);
+        for (vector<HashEntry>::iterator iter = entries.begin();
+                iter != entries.end(); iter++) {
+            DataHeader header;
+            if (readHeader(iter->GetHeaderOffsetPhy(), header)
+                    && header.GetDigest() == *digest) {
+                HashEntry entry(header, iter->GetHeaderOffsetPhy());
                 slice->SetHashEntry(&entry);
-                __DEBUG("IndexManger: entry : header_offset = %lu, data_offset = %u, next_header=%u",
-                        entry.GetHeaderOffsetPhy(), entry.GetDataOffsetInSeg(),
-                        entry.GetNextHeadOffsetInSeg());
                 return true;
             }
         }
+        return false;
+    }
+
+    HashEntry entry;
+    bool found;
+    if (paged_) {
+        std::lock_guard<std::mutex> l(pagedTable_->GetLock(*digest));
+        found = pagedTable_->Get(*digest, entry);
+    } else {
+        found = hashtable_->Lookup(*digest, entry);
+    }
+    if (found) {
+        slice->SetHashEntry(&entry);
+        __DEBUG("IndexManger: entry : header_offset = %lu, data_offset = %u, next_header=%u",
+                entry.GetHeaderOffsetPhy(), entry.GetDataOffsetInSeg(),
+                entry.GetNextHeadOffsetInSeg());
+        return true;
     }
     return false;
 }
 
 uint64_t IndexManager::GetDataTheorySize() const {
-    std::lock_guard<std::mutex> l(mtx_);
-    return dataTheorySize_;
+    lockStripes();
+    uint64_t data_size = sumDataTheorySize();
+    unlockStripes();
+    return data_size;
 }
 
 uint32_t IndexManager::GetKeyCounter() const {
-    std::lock_guard<std::mutex> l(mtx_);
-    return keyCounter_;
+    lockStripes();
+    uint32_t key_num = sumKeyCounter();
+    unlockStripes();
+    return key_num;
 }
 
 bool IndexManager::IsSameInMem(HashEntry entry)
 {
     Kvdb_Digest digest = entry.GetKeyDigest();
-    uint32_t hash_index = KeyDigestHandle::Hash(&digest) % htSize_;
 
-    std::lock_guard<std::mutex> l(hashtable_[hash_index].slotMtx_);
-    LinkedList<HashEntry> *entry_list = hashtable_[hash_index].entryList_;
+    //the record at the offset of entry is the key itself
+    if (lean_) {
+        vector<HashEntry> entries;
+        leanTable_->Lookup(digest, entries);
+        for (vector<HashEntry>::iterator iter = entries.begin();
+                iter != entries.end(); iter++) {
+            if (iter->GetHeaderOffsetPhy() == entry.GetHeaderOffsetPhy()) {
+                return true;
+            }
+        }
+        __DEBUG("Not Same, because entry is not exist!");
+        return false;
+    }
 
-    bool is_exist = entry_list->search(entry);
-    if (!is_exist) {
+    HashEntry entry_inMem;
+    bool found;
+    if (paged_) {
+        std::lock_guard<std::mutex> l(pagedTable_->GetLock(digest));
+        found = pagedTable_->Get(digest, entry_inMem);
+    } else {
+        found = hashtable_->Lookup(digest, entry_inMem);
+    }
+    if (!found) {
         __DEBUG("Not Same, because entry is not exist!");
         return false;
     } else {
-        HashEntry *entry_inMem = entry_list->getRef(entry);
-        __DEBUG("the entry header_offset = %ld, in memory entry header_offset=%ld", entry.GetHeaderOffsetPhy(), entry_inMem->GetHeaderOffsetPhy());
-        if (entry_inMem->GetHeaderOffsetPhy() == entry.GetHeaderOffsetPhy()) {
+        __DEBUG("the entry header_offset = %ld, in memory entry header_offset=%ld", entry.GetHeaderOffsetPhy(), entry_inMem.GetHeaderOffsetPhy());
+        if (entry_inMem.GetHeaderOffsetPhy() == entry.GetHeaderOffsetPhy()) {
             __DEBUG("Same, because entry is same with in memory!");
             return true;
         }
@@ -398,28 +1164,194 @@ bool IndexManager::IsSameInMem(HashEntry entry)
     return false;
 }
 
+uint32_t IndexManager::GetBucketNum() const {
+    return table_->GetBucketNum();
+}
+
+void IndexManager::GetEntriesByNo(uint32_t no, vector<HashEntry>& entries) {
+    if (!lean_) {
+        table_->GetEntries(no, entries);
+        return;
+    }
+
+    vector<HashEntry> lean_entries;
+    leanTable_->GetEntries(no, lean_entries);
+    for (vector<HashEntry>::iterator iter = lean_entries.begin();
+            iter != lean_entries.end(); iter++) {
+        DataHeader header;
+        if (readHeader(iter->GetHeaderOffsetPhy(), header)) {
+            entries.push_back(HashEntry(header, iter->GetHeaderOffsetPhy()));
+        }
+    }
+}
+
+void IndexManager::GetLeanEntries(KVSlice *slice, vector<HashEntry>& entries) {
+    leanTable_->Lookup(slice->GetDigest(), entries);
+}
+
+bool IndexManager::NeedWriteback() const {
+    return paged_ && pagedTable_->NeedWriteback();
+}
+
+void IndexManager::readLeanHeaders(const Kvdb_Digest& digest,
+                                   vector<HashEntry>& read) {
+    vector<HashEntry> entries;
+    leanTable_->Lookup(digest, entries);
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        DataHeader header;
+        if (readHeader(iter->GetHeaderOffsetPhy(), header)) {
+            read.push_back(HashEntry(header, iter->GetHeaderOffsetPhy()));
+        }
+    }
+}
+
+bool IndexManager::getLocked(const Kvdb_Digest& digest, HashEntry& entry,
+                             const HashEntry* hint,
+                             const vector<HashEntry>* read) {
+    if (paged_) {
+        return pagedTable_->Get(digest, entry);
+    }
+    if (!lean_) {
+        HashEntry *entry_inMem = hashtable_->Get(digest);
+        if (!entry_inMem) {
+            return false;
+        }
+        entry = *entry_inMem;
+        return true;
+    }
+
+    vector<HashEntry> entries;
+    leanTable_->Get(digest, entries);
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        uint64_t offset = iter->GetHeaderOffsetPhy();
+        //the caller only asks if the record of hint is still indexed
+        if (hint) {
+            if (offset == hint->GetHeaderOffsetPhy()) {
+                entry = *hint;
+                return true;
+            }
+            continue;
+        }
+        //no segment was freed since read was taken, so the record at the
+        //offset is still the one read
+        const HashEntry *known = NULL;
+        for (uint32_t i = 0; read && i < read->size(); i++) {
+            if ((*read)[i].GetHeaderOffsetPhy() == offset) {
+                known = &(*read)[i];
+                break;
+            }
+        }
+        if (known) {
+            if (known->GetKeyDigest() == digest) {
+                entry = *known;
+                return true;
+            }
+            continue;
+        }
+        DataHeader header;
+        if (readHeader(offset, header) && header.GetDigest() == digest) {
+            entry = HashEntry(header, offset);
+            return true;
+        }
+    }
+    return false;
+}
+
+void IndexManager::putLocked(const HashEntry& entry, const HashEntry* old) {
+    if (paged_) {
+        pagedTable_->Put(entry);
+        return;
+    }
+    if (!lean_) {
+        hashtable_->Put(entry);
+        return;
+    }
+    leanTable_->Put(entry, old ? old->GetHeaderOffsetPhy()
+                               : LeanHashTable::NO_OFFSET);
+}
+
+void IndexManager::removeLocked(const HashEntry& entry) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    if (paged_) {
+        pagedTable_->Remove(digest);
+        return;
+    }
+    if (!lean_) {
+        hashtable_->Remove(digest);
+        return;
+    }
+    leanTable_->Remove(digest, entry.GetHeaderOffsetPhy());
+}
+
+bool IndexManager::loadPage(uint32_t range_no, vector<HashEntry>& entries) {
+    char *blocks;
+    if (posix_memalign((void **) &blocks, 4096, 2 * INDEX_BLOCK_SIZE)) {
+        return false;
+    }
+    if (!loadDataFromDevice(blocks, 2 * INDEX_BLOCK_SIZE, rangeOffset(range_no, 0))) {
+        free(blocks);
+        return false;
+    }
+
+    std::unique_lock<std::mutex> meta_lck(mtx_);
+    uint64_t load_gen = loadGen_;
+    int copy = chooseCopy(blocks, range_no, load_gen);
+    if (rangeCopy_[range_no] == RANGE_COPY_UNKNOWN) {
+        rangeCopy_[range_no] = copy < 0 ? 1 : copy;
+    }
+    meta_lck.unlock();
+
+    bool ret;
+    if (copy < 0) {
+        //a new DB has no blocks before its first checkpoint
+        ret = !load_gen;
+        if (!ret) {
+            __ERROR("No valid index block on device for range %u", range_no);
+        }
+    } else {
+        ret = decodeBlock(&blocks[copy * INDEX_BLOCK_SIZE], entries);
+        if (!ret) {
+            __ERROR("Could not decode index block of range %u", range_no);
+        }
+    }
+    free(blocks);
+    return ret;
+}
+
+bool IndexManager::readHeader(uint64_t offset, DataHeader& header) {
+    if (bdev_->pRead(&header, sizeof(DataHeader), offset)
+            != (ssize_t) sizeof(DataHeader)) {
+        __ERROR("Could not read data header at %lu", offset);
+        return false;
+    }
+    return true;
+}
+
 uint64_t IndexManager::ComputeIndexSizeOnDevice(uint32_t ht_size) {
-    uint64_t index_size = sizeof(time_t)
-            + sizeof(int) * ht_size
-            + IndexManager::SizeOfHashEntryOnDisk() * ht_size;
-    uint64_t index_size_pages = index_size / getpagesize();
-    return (index_size_pages + 1) * getpagesize();
+    return (uint64_t) computeRangeNum(ht_size) * 2 * INDEX_BLOCK_SIZE;
 }
 
 IndexManager::IndexManager(BlockDevice* bdev, SuperBlockManager* sbMgr,
                            SegmentManager* segMgr, Options &opt) :
-    hashtable_(NULL), htSize_(0), keyCounter_(0), dataTheorySize_(0),
+    table_(NULL), hashtable_(NULL), leanTable_(NULL), pagedTable_(NULL),
+            lean_(false), paged_(false),
+            htSize_(0), keyCounter_(0), dataTheorySize_(0),
             startOff_(0), bdev_(bdev), sbMgr_(sbMgr), segMgr_(segMgr),
-            options_(opt) {
-    lastTime_ = new KVTime();
+            options_(opt), indexOff_(0), indexSegNum_(0), loadGen_(0),
+            needFull_(false), overflow_(false), ckptFull_(false),
+            ckptRelocated_(false), oldHtSize_(0), oldIndexOff_(0),
+            oldIndexSegNum_(0), numaNodes_(1) {
+    seqNum_.store(0);
+    nodeThdStop_.store(false);
+    loadRangeNo_.store(0);
+    loadFailed_.store(false);
     return;
 }
 
 IndexManager::~IndexManager() {
-    if (lastTime_) {
-        delete lastTime_;
-    }
-    if (hashtable_) {
+    if (table_) {
         destroyHashTable();
     }
 }
@@ -437,13 +1369,29 @@ uint32_t IndexManager::ComputeHashSizeForPower2(uint32_t number) {
 }
 
 void IndexManager::initHashTable(uint32_t size) {
-    hashtable_ = new HashtableSlot[htSize_];
+    startNodeThds();
+    if (paged_) {
+        pagedTable_ = new PagedHashTable(this, options_.index_cache_pages,
+                                         options_.index_lock_num);
+        table_ = pagedTable_;
+    } else if (lean_) {
+        leanTable_ = new LeanHashTable(size, options_.index_lock_num,
+                                       numaNodes_);
+        table_ = leanTable_;
+    } else {
+        hashtable_ = new HashTable(size, options_.index_lock_num, numaNodes_);
+        table_ = hashtable_;
+    }
     return;
 }
 
 void IndexManager::destroyHashTable() {
-    delete[] hashtable_;
+    stopNodeThds();
+    delete table_;
+    table_ = NULL;
     hashtable_ = NULL;
+    leanTable_ = NULL;
+    pagedTable_ = NULL;
     return;
 }
 
@@ -453,113 +1401,160 @@ bool IndexManager::rebuildHashTable(uint64_t offset) {
 
     __DEBUG("initHashTable success");
 
-    //Read hashtable
-    uint64_t table_length = sizeof(int) * htSize_;
-    int* counter = new int[htSize_];
-    if (!loadDataFromDevice((void*) counter, table_length, offset)) {
-        return false;
-    }
-    offset += table_length;
-    __DEBUG("Read hashtable success");
+    uint32_t range_num = computeRangeNum(htSize_);
+    rangeCopy_.assign(range_num, 0);
+    keyCounter_ = 0;
+    dataTheorySize_ = 0;
 
-    //Read all hash_entry
-    uint64_t length = IndexManager::SizeOfHashEntryOnDisk() * htSize_;
-    HashEntryOnDisk *entry_ondisk = new HashEntryOnDisk[htSize_];
-    if (!loadDataFromDevice((void*) entry_ondisk, length, offset)) {
-        return false;
+    uint64_t committed_gen = sbMgr_->GetCheckpointGen();
+    if (paged_) {
+        loadGen_ = committed_gen;
+        //pages are read when used, the ranges are only read now to count
+        //the keys of an index not closed cleanly
+        if (sbMgr_->IsCleanShutdown()) {
+            rangeCopy_.assign(range_num, RANGE_COPY_UNKNOWN);
+            return true;
+        }
     }
-    offset += length;
-    __DEBUG("Read all hash_entry success");
 
-    //Convert hashtable from device to memory
-    if (!convertHashEntryFromDiskToMem(counter, entry_ondisk)) {
+    //Every thread reads INDEX_LOAD_RANGE_NUM ranges at once and inserts
+    //them, so reads of some threads overlap inserts of others
+    loadRangeNo_.store(0);
+    loadFailed_.store(false);
+    uint32_t thd_num = (range_num + INDEX_LOAD_RANGE_NUM - 1) / INDEX_LOAD_RANGE_NUM;
+    thd_num = std::min(thd_num, (uint32_t) INDEX_LOAD_THREAD_NUM);
+    vector<std::thread> thds;
+    for (uint32_t i = 0; i < thd_num; i++) {
+        thds.push_back(std::thread(&IndexManager::loadThdEntry, this, offset,
+                                   committed_gen));
+    }
+    for (auto &th : thds) {
+        th.join();
+    }
+    if (loadFailed_.load()) {
         return false;
-    } 
-    __DEBUG("rebuild hash_table success");
+    }
+    __DEBUG("rebuild hash_table success, %u ranges by %u threads", range_num, thd_num);
 
-    delete[] entry_ondisk;
-    delete[] counter;
     return true;
 }
 
-bool IndexManager::loadDataFromDevice(void* data, uint64_t length,
-                                      uint64_t offset) {
-    if (bdev_->pRead(data, length, offset) != (ssize_t) length) {
-        __ERROR("Error in reading hashtable from file\n");
-        return false;
+void IndexManager::loadThdEntry(uint64_t offset, uint64_t committed_gen) {
+    uint64_t range_length = 2 * INDEX_BLOCK_SIZE;
+    char *buf;
+    if (posix_memalign((void **) &buf, 4096, range_length * INDEX_LOAD_RANGE_NUM)) {
+        loadFailed_.store(true);
+        return;
     }
-    return true;
-}
 
-bool IndexManager::writeDataToDevice(void* data, uint64_t length,
-                                     uint64_t offset) {
-    if (bdev_->pWrite(data, length, offset) != (ssize_t) length) {
-        __ERROR("Error in writing hashtable to file\n");
-        return false;
+    uint32_t range_num = computeRangeNum(htSize_);
+    uint32_t key_num = 0;
+    uint64_t data_size = 0;
+    uint32_t first;
+    while (!loadFailed_.load()
+            && (first = loadRangeNo_.fetch_add(INDEX_LOAD_RANGE_NUM)) < range_num) {
+        uint32_t num = std::min((uint32_t) INDEX_LOAD_RANGE_NUM, range_num - first);
+        if (!loadDataFromDevice((void*) buf, range_length * num,
+                                offset + range_length * first)) {
+            loadFailed_.store(true);
+            break;
+        }
+        for (uint32_t i = 0; i < num; i++) {
+            if (!loadRange(first + i, &buf[range_length * i], committed_gen,
+                           key_num, data_size)) {
+                loadFailed_.store(true);
+                break;
+            }
+        }
     }
-    return true;
-}
+    free(buf);
 
-bool IndexManager::convertHashEntryFromDiskToMem(int* counter,
-                                                 HashEntryOnDisk* entry_ondisk) {
-    //Convert hashtable from device to memory
-    int entry_index = 0;
-    for (uint32_t i = 0; i < htSize_; i++) {
+    keyCounter_ += key_num;
+    dataTheorySize_ += data_size;
+}
 
-        int entry_num = counter[i];
-        for (int j = 0; j < entry_num; j++) {
-            HashEntry entry(entry_ondisk[entry_index], *lastTime_, 0);
+bool IndexManager::loadRange(uint32_t range_no, char* blocks,
+                             uint64_t committed_gen, uint32_t& key_num,
+                             uint64_t& data_size) {
+    //a block written after the committed checkpoint doesn't count
+    int copy = chooseCopy(blocks, range_no, committed_gen);
+    if (copy < 0) {
+        __ERROR("No valid index block on device for range %u", range_no);
+        return false;
+    }
+    rangeCopy_[range_no] = copy;
 
-            hashtable_[i].entryList_->put(entry);
-            entry_index++;
+    vector<HashEntry> entries;
+    if (!decodeBlock(&blocks[copy * INDEX_BLOCK_SIZE], entries)) {
+        __ERROR("Could not decode index block of range %u", range_no);
+        return false;
+    }
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        //the paged index reads its pages when used
+        if (!paged_) {
+            Kvdb_Digest digest = iter->GetKeyDigest();
+            std::unique_lock<std::mutex> l(table_->GetLock(digest));
+            putLocked(*iter, NULL);
         }
-        if (entry_num > 0) {
-            __DEBUG("read hashtable[%d]=%d", i, entry_num);
+
+        key_num++;
+        //a delete stays indexed without data
+        if (iter->GetDataSize()) {
+            data_size += SizeOfDataHeader() + iter->GetDataSize();
         }
     }
-    keyCounter_ = entry_index;
+    if (!entries.empty()) {
+        __DEBUG("read index range[%u]=%lu, generation %lu", range_no, entries.size(),
+                ((IndexBlockHeader *) &blocks[copy * INDEX_BLOCK_SIZE])->gen);
+    }
     return true;
 }
 
-bool IndexManager::persistHashTable(uint64_t offset)
-{
-    uint32_t entry_total = 0;
-
-    //write hashtable to device
-    uint64_t table_length = sizeof(int) * htSize_;
-    int* counter = new int[htSize_];
-    for (uint32_t i = 0; i < htSize_; i++) {
-        //counter[i] = (hashtable_[i].entryList_? hashtable_[i].entryList_->get_size(): 0);
-        counter[i] = hashtable_[i].entryList_->get_size();
-        entry_total += counter[i];
+int IndexManager::chooseCopy(char* blocks, uint32_t range_no, uint64_t max_gen) {
+    int copy = -1;
+    uint64_t gen = 0;
+    for (int i = 0; i < 2; i++) {
+        char *block = &blocks[i * INDEX_BLOCK_SIZE];
+        IndexBlockHeader *header = (IndexBlockHeader *) block;
+        if (!checkBlock(block, range_no) || header->gen > max_gen) {
+            continue;
+        }
+        if (copy < 0 || header->gen > gen) {
+            copy = i;
+            gen = header->gen;
+        }
     }
+    return copy;
+}
 
-    if (!writeDataToDevice((void*)counter, table_length, offset)) {
-        return false;
-    }
-    offset += table_length;
-    delete[] counter;
-    __DEBUG("write hashtable to device success");
+bool IndexManager::checkBlock(char* block, uint32_t range_no) {
+    IndexBlockHeader *header = (IndexBlockHeader *) block;
+    uint32_t checksum = header->checksum;
+    header->checksum = 0;
+    bool valid = checksum == KVCrc::Crc32c(0, block, INDEX_BLOCK_SIZE);
+    header->checksum = checksum;
+    return valid && header->gen != 0 && header->range_no == range_no
+            && header->format == (lean_ ? INDEX_BLOCK_FORMAT_LEAN : INDEX_BLOCK_FORMAT)
+            && header->length <= blockDataSize();
+}
 
-    //write hash entry to device
-    uint64_t length = IndexManager::SizeOfHashEntryOnDisk() * entry_total;
-    HashEntryOnDisk *entry_ondisk = new HashEntryOnDisk[entry_total];
-    int entry_index = 0;
-    for (uint32_t i = 0; i < htSize_; i++) {
-        vector<HashEntry> tmp_vec = hashtable_[i].entryList_->get();
-        for (vector<HashEntry>::iterator iter = tmp_vec.begin(); iter!=tmp_vec.end(); iter++) {
-            entry_ondisk[entry_index++] = (iter->GetEntryOnDisk());
-        }
+bool IndexManager::loadDataFromDevice(void* data, uint64_t length,
+                                      uint64_t offset) {
+    if (bdev_->pRead(data, length, offset) != (ssize_t) length) {
+        __ERROR("Error in reading hashtable from file\n");
+        return false;
     }
+    return true;
+}
 
-    if (!writeDataToDevice((void *)entry_ondisk, length, offset)) {
+bool IndexManager::writeDataToDevice(void* data, uint64_t length,
+                                     uint64_t offset) {
+    if (bdev_->pWrite(data, length, offset) != (ssize_t) length) {
+        __ERROR("Error in writing hashtable to file\n");
         return false;
     }
-    delete[] entry_ondisk;
-    __DEBUG("write all hash entry to device success");
-
     return true;
-
-}
 }
 
+}
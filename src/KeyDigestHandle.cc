@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 #include "KeyDigestHandle.h"
 
@@ -89,9 +90,66 @@ void KeyDigestHandle::ComputeDigest(const Kvdb_Key *key, Kvdb_Digest &digest)
     digest.SetDigest((unsigned char*) hashcode, RMDsize / 8);
 }
 
-uint32_t KeyDigestHandle::Hash(const Kvdb_Key *key) {
+void KeyDigestHandle::ComputeDigest(const Kvdb_Key *key, Kvdb_Digest &digest,
+                                    int type) {
+    if (type == DIGEST_MURMUR3) {
+        computeMurmur3(key, digest);
+    } else {
+        ComputeDigest(key, digest);
+    }
+}
+
+// RIPEMD-160 digests of many keys are computed a vector of keys at a time,
+// small batches would leave most lanes empty and stay scalar.
+void KeyDigestHandle::ComputeDigests(const Kvdb_Key *keys,
+                                     Kvdb_Digest *digests, int num, int type) {
+    if (type == DIGEST_MURMUR3 || num < RMD_MB_MIN_KEYS) {
+        for (int i = 0; i < num; i++) {
+            ComputeDigest(&keys[i], digests[i], type);
+        }
+        return;
+    }
+
+    std::vector<const byte *> msgs(num);
+    std::vector<dword> lens(num);
+    std::vector<dword> MDbufs(num * RMDsize / 32);
+    for (int i = 0; i < num; i++) {
+        msgs[i] = (const byte *) keys[i].GetValue();
+        lens[i] = keys[i].GetLen();
+    }
+    MDmulti(msgs.data(), lens.data(), num, MDbufs.data());
+
+    byte hashcode[RMDsize / 8];
+    for (int i = 0; i < num; i++) {
+        const dword *MDbuf = &MDbufs[i * RMDsize / 32];
+        for (int j = 0; j < RMDsize / 8; j += 4) {
+            hashcode[j] = MDbuf[j >> 2];
+            hashcode[j + 1] = (MDbuf[j >> 2] >> 8);
+            hashcode[j + 2] = (MDbuf[j >> 2] >> 16);
+            hashcode[j + 3] = (MDbuf[j >> 2] >> 24);
+        }
+        digests[i].SetDigest((unsigned char*) hashcode, RMDsize / 8);
+    }
+}
+
+// 128 bits of MurmurHash3, the last word is remixed from both halves so
+// Hash() and Tag() see independent bits as with RIPEMD-160.
+void KeyDigestHandle::computeMurmur3(const Kvdb_Key *key, Kvdb_Digest &digest) {
+    uint64_t h[2];
+    MurmurHash3_x64_128(key->GetValue(), key->GetLen(), 0, h);
+
+    uint64_t k = h[0] ^ h[1];
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+
+    memcpy(digest.value, h, sizeof(h));
+    digest.value[4] = (uint32_t) k;
+}
+
+uint32_t KeyDigestHandle::Hash(const Kvdb_Key *key, int type) {
     Kvdb_Digest result;
-    ComputeDigest(key, result);
+    ComputeDigest(key, result, type);
 
     uint32_t hash_value = Hash(&result);
 
@@ -111,6 +169,26 @@ uint32_t KeyDigestHandle::Hash(const Kvdb_Digest *digest) {
     return hash_value;
 }
 
+// Short fingerprint taken from digest bits not used by Hash(), never 0 since
+// 0 marks an empty slot in the index buckets.
+uint16_t KeyDigestHandle::Tag(const Kvdb_Digest *digest) {
+    const unsigned char *pc = digest->GetDigest() + 3 * sizeof(uint32_t);
+    uint16_t tag = pc[0] + (pc[1] << 8);
+    return tag ? tag : 1;
+}
+
+Kvdb_Digest KeyDigestHandle::Fingerprint(uint32_t hash, uint16_t tag) {
+    Kvdb_Digest digest;
+    unsigned char *pc = digest.GetDigest();
+    pc[12] = tag & 0xff;
+    pc[13] = tag >> 8;
+    pc[16] = hash & 0xff;
+    pc[17] = (hash >> 8) & 0xff;
+    pc[18] = (hash >> 16) & 0xff;
+    pc[19] = hash >> 24;
+    return digest;
+}
+
 string KeyDigestHandle::Tostring(Kvdb_Digest *digest) {
     int digest_size = KeyDigestHandle::SizeOfDigest();
     unsigned char *temp = digest->GetDigest();
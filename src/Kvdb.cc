@@ -45,8 +45,8 @@ DB::~DB() {
 }
 
 Status DB::Insert(const char* key, uint32_t key_len, const char* data,
-                uint16_t length) {
-    Status s = kvds_->Insert(key, key_len, data, length);
+                uint16_t length, const WriteOptions& wopts) {
+    Status s = kvds_->Insert(key, key_len, data, length, wopts);
     if (!s.ok()) {
         std::cout << "DB Insert failed" << std::endl;
     }
@@ -54,8 +54,9 @@ Status DB::Insert(const char* key, uint32_t key_len, const char* data,
     return s;
 }
 
-Status DB::Delete(const char* key, uint32_t key_len) {
-    Status s = kvds_->Delete(key, key_len);
+Status DB::Delete(const char* key, uint32_t key_len,
+                  const WriteOptions& wopts) {
+    Status s = kvds_->Delete(key, key_len, wopts);
     if (!s.ok()) {
         std::cout << "DB Delete failed" << std::endl;
     }
@@ -78,6 +79,37 @@ Status DB::InsertBatch(WriteBatch *batch) {
     return kvds_->InsertBatch(batch);
 }
 
+void DB::InsertAsync(const char* key, uint32_t key_len, const char* data,
+                     uint16_t length, WriteCallback cb,
+                     const WriteOptions& wopts) {
+    kvds_->InsertAsync(key, key_len, data, length, cb, wopts);
+}
+
+std::future<Status> DB::InsertAsync(const char* key, uint32_t key_len,
+                                    const char* data, uint16_t length,
+                                    const WriteOptions& wopts) {
+    return kvds_->InsertAsync(key, key_len, data, length, wopts);
+}
+
+void DB::DeleteAsync(const char* key, uint32_t key_len, WriteCallback cb,
+                     const WriteOptions& wopts) {
+    kvds_->DeleteAsync(key, key_len, cb, wopts);
+}
+
+std::future<Status> DB::DeleteAsync(const char* key, uint32_t key_len,
+                                    const WriteOptions& wopts) {
+    return kvds_->DeleteAsync(key, key_len, wopts);
+}
+
+void DB::GetAsync(const char* key, uint32_t key_len, ReadCallback cb) {
+    kvds_->GetAsync(key, key_len, cb);
+}
+
+std::future<Status> DB::GetAsync(const char* key, uint32_t key_len,
+                                 string &data) {
+    return kvds_->GetAsync(key, key_len, data);
+}
+
 Iterator* DB::NewIterator() {
     return kvds_->NewIterator();
 }
@@ -1,34 +1,40 @@
 #include "KvdbIter.h"
 #include "IndexManager.h"
 #include "SegmentManager.h"
+#include "Segment.h"
 #include "BlockDevice.h"
 #include "Db_Structure.h"
 
 #ifdef WITH_ITERATOR
 namespace hlkvds {
 
-KvdbIter::KvdbIter(IndexManager* im, SegmentManager* sm, BlockDevice* bdev) :
-    idxMgr_(im), segMgr_(sm), bdev_(bdev), valid_(false), hashEntry_(NULL){
-        //ht_ = idxMgr_->GetHashTable();
-        htSize_ = idxMgr_->GetHashTableSize();
+KvdbIter::KvdbIter(IndexManager* im, SegmentManager* sm, BlockDevice* bdev,
+                   int digest_type) :
+    idxMgr_(im), segMgr_(sm), bdev_(bdev), valid_(false), hashEntry_(NULL),
+            digestType_(digest_type) {
+        htSize_ = idxMgr_->GetBucketNum();
 }
 
 KvdbIter::~KvdbIter() {
     valid_ = false;
 }
 
+//Copy the entries of one index bucket, the iterator walks on this copy
+int KvdbIter::loadEntryList(int no) {
+    entryList_.clear();
+    idxMgr_->GetEntriesByNo(no, entryList_);
+    return entryList_.size();
+}
+
 void KvdbIter::SeekToFirst() {
-    LinkedList<HashEntry> *entry_list;
     hashEntry_ = NULL;
-    htSize_ = idxMgr_->GetHashTableSize();
+    htSize_ = idxMgr_->GetBucketNum();
     for (int i = 0; i < htSize_; i++) {
-        //entry_list = ht_[i].entryList_;
-        entry_list = idxMgr_->GetEntryListByNo(i);
-        int entry_list_size = entry_list->get_size();
+        int entry_list_size = loadEntryList(i);
         if (entry_list_size > 0) {
             hashTableCur_ = i;
             entryListCur_ = 0;
-            hashEntry_ = entry_list->getByNo(entryListCur_);
+            hashEntry_ = &entryList_[entryListCur_];
             break;
         }
     }
@@ -43,19 +49,14 @@ void KvdbIter::SeekToFirst() {
 }
 
 void KvdbIter::SeekToLast() {
-    LinkedList<HashEntry> *entry_list;
     hashEntry_ = NULL;
-    htSize_ = idxMgr_->GetHashTableSize();
-    //__INFO("htSize_=%d",htSize_);
+    htSize_ = idxMgr_->GetBucketNum();
     for (int i = htSize_ - 1; i >= 0; i--) {
-        //entry_list = ht_[i].entryList_;
-        entry_list = idxMgr_->GetEntryListByNo(i);
-        int entry_list_size = entry_list->get_size();
-        //__INFO("entry_list_size=%d",entry_list_size);
+        int entry_list_size = loadEntryList(i);
         if (entry_list_size > 0) {
             hashTableCur_ = i;
             entryListCur_ = entry_list_size - 1;
-            hashEntry_ = entry_list->getByNo(entryListCur_);
+            hashEntry_ = &entryList_[entryListCur_];
             break;
         }
     }
@@ -65,27 +66,25 @@ void KvdbIter::SeekToLast() {
     } else {
         valid_ = false;
     }
-    //__INFO("hastTableCur_ = %d, entryListCur_ = %d", hashTableCur_, entryListCur_);
 
 }
 
 void KvdbIter::Seek(const char* key) {
-    //need hashEntry;
     int key_len = strlen(key);
-    KVSlice slice(key, key_len, NULL, 0);
-    DataHeader data_header;
-    data_header.SetDigest(slice.GetDigest());
-    HashEntry entry(data_header, 0, NULL);
+    KVSlice slice(key, key_len, NULL, 0, false, digestType_);
     
-    LinkedList<HashEntry> *entry_list;
     hashEntry_ = NULL;
     for (int i = 0; i < htSize_; i++) {
-        //entry_list = ht_[i].entryList_;
-        entry_list = idxMgr_->GetEntryListByNo(i);
-        hashEntry_ = entry_list->getRef(entry);
+        int entry_list_size = loadEntryList(i);
+        for (int j = 0; j < entry_list_size; j++) {
+            if (entryList_[j].GetKeyDigest() == slice.GetDigest()) {
+                hashTableCur_ = i;
+                entryListCur_ = j;
+                hashEntry_ = &entryList_[entryListCur_];
+                break;
+            }
+        }
         if (NULL != hashEntry_) {
-            hashTableCur_ = i;
-            entryListCur_ = entry_list->searchNo(entry);
             break;
         }
     }
@@ -98,23 +97,18 @@ void KvdbIter::Seek(const char* key) {
 }
 
 void KvdbIter::Next() {
-    LinkedList<HashEntry> *entry_list;
-    //entry_list = ht_[hashTableCur_];
-    entry_list = idxMgr_->GetEntryListByNo(hashTableCur_);
     hashEntry_ = NULL;
-    int entry_list_size = entry_list->get_size();
+    int entry_list_size = entryList_.size();
     if ( entryListCur_ < entry_list_size - 1) {
         entryListCur_++;
-        hashEntry_ = entry_list->getByNo(entryListCur_);
+        hashEntry_ = &entryList_[entryListCur_];
     } else {
         hashTableCur_++;
         while (hashTableCur_ < htSize_) {
-            //entry_list = ht_[i].entryList_;
-            entry_list = idxMgr_->GetEntryListByNo(hashTableCur_);
-            entry_list_size = entry_list->get_size();
+            entry_list_size = loadEntryList(hashTableCur_);
             if (entry_list_size  > 0) {
                 entryListCur_ = 0;
-                hashEntry_ = entry_list->getByNo(entryListCur_);
+                hashEntry_ = &entryList_[entryListCur_];
                 break;
             }
             hashTableCur_++;
@@ -126,27 +120,21 @@ void KvdbIter::Next() {
     } else {
         valid_ = false;
     }
-    //__INFO("hastTableCur_ = %d, entryListCur_ = %d", hashTableCur_, entryListCur_);
 }
 
 void KvdbIter::Prev() {
-    LinkedList<HashEntry> *entry_list;
-    //entry_list = ht_[hashTableCur_];
-    entry_list = idxMgr_->GetEntryListByNo(hashTableCur_);
     hashEntry_ = NULL;
-    int entry_list_size = entry_list->get_size();
+    int entry_list_size = entryList_.size();
     if (entryListCur_ > 0) {
         entryListCur_--;
-        hashEntry_ = entry_list->getByNo(entryListCur_);
+        hashEntry_ = &entryList_[entryListCur_];
     } else {
         hashTableCur_--;
         while (hashTableCur_ >= 0) {
-            //entry_list = ht_[i].entryList_;
-            entry_list = idxMgr_->GetEntryListByNo(hashTableCur_);
-            entry_list_size = entry_list->get_size();
+            entry_list_size = loadEntryList(hashTableCur_);
             if ( entry_list_size > 0) {
                 entryListCur_ = entry_list_size - 1;
-                hashEntry_ = entry_list->getByNo(entryListCur_);
+                hashEntry_ = &entryList_[entryListCur_];
                 break;
             }
             hashTableCur_--;
@@ -158,7 +146,6 @@ void KvdbIter::Prev() {
     } else {
         valid_ = false;
     }
-    //__INFO("hastTableCur_ = %d, entryListCur_ = %d", hashTableCur_, entryListCur_);
 }
 
 string KvdbIter::Key() {
@@ -3,10 +3,12 @@
 #include <inttypes.h>
 #include <thread>
 #include <map>
+#include <algorithm>
 
 #include "Kvdb_Impl.h"
 #include "KeyDigestHandle.h"
 #include "KvdbIter.h"
+#include "RecoveryManager.h"
 
 namespace hlkvds {
 
@@ -30,6 +32,8 @@ KVDS* KVDS::Create_KVDS(const char* filename, Options opts) {
 
     uint32_t hash_table_size = ds->options_.hashtable_size;
     uint32_t segment_size = ds->options_.segment_size;
+    uint32_t digest_type = ds->options_.digest_type;
+    uint32_t index_mode = ds->options_.index_mode;
 
     int r = 0;
     r = ds->bdev_->Open(filename);
@@ -46,6 +50,21 @@ KVDS* KVDS::Create_KVDS(const char* filename, Options opts) {
         return NULL;
     }
 
+    if (digest_type != DIGEST_RMD160 && digest_type != DIGEST_MURMUR3) {
+        __ERROR("Unknown key digest type, %d", digest_type);
+        delete ds;
+        return NULL;
+    }
+
+    //lean index slots keep 48 bits of the header offset
+    if ((index_mode != INDEX_MODE_FULL && index_mode != INDEX_MODE_LEAN
+            && index_mode != INDEX_MODE_PAGED)
+            || (index_mode == INDEX_MODE_LEAN && (device_capacity >> 48))) {
+        __ERROR("Improper index mode, %d", index_mode);
+        delete ds;
+        return NULL;
+    }
+
     //Init Superblock region
     db_sb_size = SuperBlockManager::GetSuperBlockSizeOnDevice();
     __DEBUG("super block size; %ld",db_sb_size);
@@ -108,9 +127,16 @@ KVDS* KVDS::Create_KVDS(const char* filename, Options opts) {
     DBSuperBlock sb(MAGIC_NUMBER, hash_table_size, num_entries, segment_size,
                     number_segments, 0, db_sb_size, db_index_size,
                     db_seg_table_size, db_data_region_size, device_capacity,
-                    data_theory_size);
+                    data_theory_size, 0, 0, digest_type, index_mode);
     ds->sbMgr_->SetSuperBlock(sb);
 
+    //put the metadata on device now, a crash before close is then recoverable
+    if (!ds->writeMetaDataToDevice(true)) {
+        __ERROR("Could not write metadata to device\n");
+        delete ds;
+        return NULL;
+    }
+
     __INFO("\nCreateKVDS table information:\n"
             "\t hashtable_size            : %d\n"
             "\t num_entries               : %d\n"
@@ -122,14 +148,15 @@ KVDS* KVDS::Create_KVDS(const char* filename, Options opts) {
             "\t Total DB Meta Region Size : %ld Bytes\n"
             "\t Total DB Data Region Size : %ld Bytes\n"
             "\t Total DB Total Size       : %ld Bytes\n"
-            "\t Total Device Size         : %ld Bytes",
+            "\t Total Device Size         : %ld Bytes\n"
+            "\t Key Digest Type           : %d\n"
+            "\t Index Mode                : %d",
             hash_table_size, num_entries,
             segment_size, number_segments, db_sb_size,
             db_index_size, db_seg_table_size, db_meta_size,
-            db_data_region_size, db_size, device_capacity);
+            db_data_region_size, db_size, device_capacity, digest_type,
+            index_mode);
 
-    ds->seg_ = new SegForReq(ds->segMgr_, ds->idxMgr_, ds->bdev_,
-                                ds->options_.expired_time);
     ds->startThds();
 
     return ds;
@@ -138,7 +165,7 @@ KVDS* KVDS::Create_KVDS(const char* filename, Options opts) {
 
 Iterator* KVDS::NewIterator() {
 #ifdef WITH_ITERATOR
-    return new KvdbIter(idxMgr_, segMgr_, bdev_);
+    return new KvdbIter(idxMgr_, segMgr_, bdev_, sbMgr_->GetDigestType());
 #else
     return NULL;
 #endif
@@ -174,27 +201,18 @@ void KVDS::printDbStates() {
             "\t Total Device Size         : %ld Bytes\n"
             "\t Request Queue Size        : %d\n"
             "\t Segment Reaper Queue Size : %d\n"
-            "\t Segment Write Queue Size  : %d",
+            "\t Segment Write Queue Size  : %d\n"
+            "\t Huge Page Memory          : %lu Bytes hugetlbfs, %lu Bytes advised, %lu Bytes THP backed",
             hash_table_size, num_entries,
             segment_size, number_segments,free_segment, db_sb_size,
             db_index_size, db_seg_table_size, db_meta_size,
-            db_data_region_size, db_size, device_capacity,getReqQueSize(),getSegReaperQueSize(),getSegWriteQueSize());
+            db_data_region_size, db_size, device_capacity,getReqQueSize(),getSegReaperQueSize(),getSegWriteQueSize(),
+            KVHugeMem::HugetlbBytes(), KVHugeMem::AdvisedBytes(),
+            KVHugeMem::ThpBackedBytes());
 }
 
-bool KVDS::writeMetaDataToDevice() {
-    if (!idxMgr_->WriteIndexToDevice()) {
-        return false;
-    }
-
-    if (!segMgr_->WriteSegmentTableToDevice()) {
-        return false;
-    }
-
-    if (!sbMgr_->WriteSuperBlockToDevice()) {
-        return false;
-    }
-
-    return true;
+bool KVDS::writeMetaDataToDevice(bool full) {
+    return ckptMgr_->Checkpoint(full);
 }
 
 bool KVDS::readMetaDataFromDevice() {
@@ -202,6 +220,10 @@ bool KVDS::readMetaDataFromDevice() {
     if (!sbMgr_->LoadSuperBlockFromDevice(offset)) {
         return false;
     }
+    if (sbMgr_->GetMagic() != MAGIC_NUMBER) {
+        __ERROR("Device is not formatted with this DB version, magic number: %x", sbMgr_->GetMagic());
+        return false;
+    }
 
     uint32_t hashtable_size = sbMgr_->GetHTSize();
     uint64_t db_sb_size = SuperBlockManager::GetSuperBlockSizeOnDevice();
@@ -210,8 +232,8 @@ bool KVDS::readMetaDataFromDevice() {
         return false;
     }
 
-    uint64_t db_index_size =
-            IndexManager::ComputeIndexSizeOnDevice(hashtable_size);
+    //hashtable_size may outgrow the index region once the index relocated
+    uint64_t db_index_size = sbMgr_->GetIndexSize();
     offset += db_index_size;
     uint32_t segment_size = sbMgr_->GetSegmentSize();
     uint32_t number_segments = sbMgr_->GetSegmentNum();
@@ -221,7 +243,13 @@ bool KVDS::readMetaDataFromDevice() {
         return false;
     }
 
-    seg_ = new SegForReq(segMgr_, idxMgr_, bdev_, options_.expired_time);
+    //a checkpoint may have crashed between the segment table and the
+    //superblock, the superblock tells which segments hold the index
+    uint32_t index_seg_id = 0;
+    if (sbMgr_->GetIndexSegNum()) {
+        segMgr_->ComputeSegIdFromOffset(sbMgr_->GetIndexOffset(), index_seg_id);
+    }
+    segMgr_->SetIndexSegs(index_seg_id, sbMgr_->GetIndexSegNum());
 
     __INFO("\nReading meta information from file:\n"
             "\t hashtable_size            : %d\n"
@@ -236,7 +264,9 @@ bool KVDS::readMetaDataFromDevice() {
             "\t Total DB Total Size       : %ld Bytes\n"
             "\t Total Device Size         : %ld Bytes\n"
             "\t Current Segment ID        : %d\n"
-            "\t DB Data Theory Size       : %ld Bytes",
+            "\t DB Data Theory Size       : %ld Bytes\n"
+            "\t Key Digest Type           : %d\n"
+            "\t Index Mode                : %d",
             sbMgr_->GetHTSize(), sbMgr_->GetElementNum(),
             sbMgr_->GetSegmentSize(),
             sbMgr_->GetSegmentNum(), sbMgr_->GetSbSize(),
@@ -244,7 +274,8 @@ bool KVDS::readMetaDataFromDevice() {
             (sbMgr_->GetSbSize() + sbMgr_->GetIndexSize() + sbMgr_->GetSegTableSize()),
             sbMgr_->GetDataRegionSize(),
             (sbMgr_->GetSbSize() + sbMgr_->GetIndexSize() + sbMgr_->GetSegTableSize() + sbMgr_->GetDataRegionSize()),
-            sbMgr_->GetDeviceCapacity(), sbMgr_->GetCurSegmentId(), sbMgr_->GetDataTheorySize());
+            sbMgr_->GetDeviceCapacity(), sbMgr_->GetCurSegmentId(), sbMgr_->GetDataTheorySize(),
+            sbMgr_->GetDigestType(), sbMgr_->GetIndexMode());
 
     return true;
 }
@@ -270,82 +301,169 @@ Status KVDS::openDB() {
         __ERROR("Could not read  hash table file\n");
         return Status::IOError("Could not read  hash table file");
     }
+
+    bool clean = sbMgr_->IsCleanShutdown();
+    if (!clean) {
+        __WARN("DB was not closed cleanly, recover index from segments\n");
+        RecoveryManager recMgr(bdev_, idxMgr_, segMgr_, options_);
+        if (!recMgr.Recover(sbMgr_->GetCheckpointSeqNum())) {
+            __ERROR("Could not recover DB\n");
+            return Status::IOError("Could not recover DB");
+        }
+    }
+
+    //The index on device goes stale from now until a checkpoint, a
+    //recovered index is written back at once, whole, as blocks of a
+    //checkpoint that didn't commit may be left on device
+    sbMgr_->SetCleanShutdown(false);
+    bool ret = clean ? sbMgr_->WriteSuperBlockToDevice()
+            : writeMetaDataToDevice(true);
+    if (!ret) {
+        __ERROR("Could not write metadata to device\n");
+        return Status::IOError("Could not write metadata to device");
+    }
+
     startThds();
     return Status::OK();
 }
 
 Status KVDS::closeDB() {
-    if (!writeMetaDataToDevice()) {
+    if (shards_.empty()) {
+        //the DB was never opened
+        return Status::OK();
+    }
+    stopThds();
+
+    //only what changed since the last checkpoint is left to write
+    sbMgr_->SetCleanShutdown(true);
+    if (!writeMetaDataToDevice(false)) {
         __ERROR("Could not to write metadata to device\n");
         return Status::IOError("Could not to write metadata to device");
     }
-    stopThds();
     return Status::OK();
 }
 
 void KVDS::startThds() {
+    readT_stop_.store(false);
+    for (int i = 0; i < std::max(options_.read_thread, 1); i++) {
+        readTP_.push_back(std::thread(&KVDS::ReadThdEntry, this));
+    }
+
     reqMergeT_stop_.store(false);
-    reqMergeT_ = std::thread(&KVDS::ReqMergeThdEntry, this);
+    uint32_t shard_num = std::max(options_.req_merge_thread, 1);
+    segPoolMax_ = shard_num + std::max(options_.seg_write_thread, 0);
+    for (uint32_t i = 0; i < segPoolMax_; i++) {
+        segPool_.push_back(new SegForReq(segMgr_, idxMgr_, bdev_,
+                                         options_.expired_time));
+    }
+    for (uint32_t i = 0; i < shard_num; i++) {
+        ReqShard *shard = new ReqShard;
+        shard->seg = newSegForReq();
+        shards_.push_back(shard);
+    }
+    for (uint32_t i = 0; i < shard_num; i++) {
+        shards_[i]->reqMergeT = std::thread(&KVDS::ReqMergeThdEntry, this, i);
+    }
 
     segWriteT_stop_.store(false);
     for (int i = 0; i < options_.seg_write_thread; i++) {
         segWriteTP_.push_back(std::thread(&KVDS::SegWriteThdEntry, this));
     }
 
-    segTimeoutT_stop_.store(false);
-    segTimeoutT_ = std::thread(&KVDS::SegTimeoutThdEntry, this);
 
     segReaperT_stop_.store(false);
     segReaperT_ = std::thread(&KVDS::SegReaperThdEntry, this);
 
     gcT_stop_.store(false);
     gcT_ = std::thread(&KVDS::GCThdEntry, this);
+
+    //the paged index writes its pages back by checkpoints
+    if (options_.checkpoint_interval > 0
+            || sbMgr_->GetIndexMode() == INDEX_MODE_PAGED) {
+        ckptT_stop_.store(false);
+        ckptT_ = std::thread(&KVDS::CkptThdEntry, this);
+    }
 }
 
 void KVDS::stopThds() {
+    readT_stop_.store(true);
+    for (auto &th : readTP_) {
+        th.join();
+    }
+    //the gets left are served while the DB is still up
+    ReadReq *read_req;
+    while ((read_req = readQue_.Dequeue()) != NULL) {
+        string data;
+        Status s = Get(read_req->key.c_str(), read_req->key.size(), data);
+        read_req->cb(s, data);
+        delete read_req;
+    }
+
+    //the writes left are merged and written while the DB is still up,
+    //so every request queued before the close completes
+    reqMergeT_stop_.store(true);
+    for (uint32_t i = 0; i < shards_.size(); i++) {
+        shards_[i]->reqMergeT.join();
+        drainShard(shards_[i]);
+    }
+    while (!segWriteTP_.empty() && !allSegsApplied()) {
+        usleep(1000);
+    }
+
+    if (ckptT_.joinable()) {
+        ckptT_stop_.store(true);
+        ckptT_.join();
+    }
+
     gcT_stop_.store(true);
     gcT_.join();
 
     segReaperT_stop_.store(true);
     segReaperT_.join();
 
-    segTimeoutT_stop_.store(true);
-    segTimeoutT_.join();
 
     segWriteT_stop_.store(true);
     for(auto &th : segWriteTP_)
     {
         th.join();
     }
-
-    reqMergeT_stop_.store(true);
-    reqMergeT_.join();
 }
 
 KVDS::~KVDS() {
     closeDB();
+    //segments give their buffers back to segMgr_
+    for (uint32_t i = 0; i < shards_.size(); i++) {
+        delete shards_[i]->seg;
+        delete shards_[i];
+    }
+    for (uint32_t i = 0; i < segPool_.size(); i++) {
+        delete segPool_[i];
+    }
+    delete ckptMgr_;
     delete gcMgr_;
     delete idxMgr_;
     delete segMgr_;
     delete sbMgr_;
     delete bdev_;
-    delete seg_;
 
 }
 
 KVDS::KVDS(const string& filename, Options opts) :
-    fileName_(filename), seg_(NULL), options_(opts), reqMergeT_stop_(false),
-            segWriteT_stop_(false), segTimeoutT_stop_(false),
-            segReaperT_stop_(false), gcT_stop_(false) {
+    fileName_(filename), options_(opts), reqMergeT_stop_(false),
+            segPoolMax_(0), segWriteT_stop_(false),
+            segWriteQue_(WORK_QUEUE_CAPACITY, &segQueEvent_),
+            segUrgentQue_(WORK_QUEUE_CAPACITY, &segQueEvent_),
+            segReaperT_stop_(false), readT_stop_(false), gcT_stop_(false),
+            ckptT_stop_(false) {
     bdev_ = BlockDevice::CreateDevice();
     sbMgr_ = new SuperBlockManager(bdev_, options_);
     segMgr_ = new SegmentManager(bdev_, sbMgr_, options_);
     idxMgr_ = new IndexManager(bdev_, sbMgr_, segMgr_, options_);
     gcMgr_ = new GcManager(bdev_, idxMgr_, segMgr_, options_);
+    ckptMgr_ = new CheckpointManager(sbMgr_, idxMgr_, segMgr_, options_);
 }
 
-Status KVDS::Insert(const char* key, uint32_t key_len, const char* data,
-                      uint16_t length) {
+Status KVDS::checkInsert(const char* key, uint16_t length) {
     if (key == NULL || key[0] == '\0') {
         return Status::InvalidArgument("Key is null or empty.");
     }
@@ -356,15 +474,25 @@ Status KVDS::Insert(const char* key, uint32_t key_len, const char* data,
         return Status::NotSupported(
                                     "Data length cann't be longer than max segment size");
     }
+    return Status::OK();
+}
+
+Status KVDS::Insert(const char* key, uint32_t key_len, const char* data,
+                      uint16_t length, const WriteOptions& wopts) {
+    Status s = checkInsert(key, length);
+    if (!s.ok()) {
+        return s;
+    }
 
-    KVSlice slice(key, key_len, data, length);
+    KVSlice slice(key, key_len, data, length, false, sbMgr_->GetDigestType());
 
-    return insertKey(slice);
+    return insertKey(slice, wopts);
 
 }
 
-Status KVDS::Delete(const char* key, uint32_t key_len) {
-    return Insert(key, key_len, NULL, 0);
+Status KVDS::Delete(const char* key, uint32_t key_len,
+                    const WriteOptions& wopts) {
+    return Insert(key, key_len, NULL, 0, wopts);
 }
 
 Status KVDS::Get(const char* key, uint32_t key_len, string &data) {
@@ -373,7 +501,11 @@ Status KVDS::Get(const char* key, uint32_t key_len, string &data) {
         return Status::InvalidArgument("Key is null.");
     }
 
-    KVSlice slice(key, key_len, NULL, 0);
+    KVSlice slice(key, key_len, NULL, 0, false, sbMgr_->GetDigestType());
+
+    if (idxMgr_->IsLean()) {
+        return readLean(slice, data);
+    }
 
     res = idxMgr_->GetHashEntry(&slice);
     if (!res) {
@@ -385,6 +517,72 @@ Status KVDS::Get(const char* key, uint32_t key_len, string &data) {
 
 }
 
+void KVDS::InsertAsync(const char* key, uint32_t key_len, const char* data,
+                       uint16_t length, WriteCallback cb,
+                       const WriteOptions& wopts) {
+    Status s = checkInsert(key, length);
+    if (!s.ok()) {
+        cb(s);
+        return;
+    }
+
+    KVSlice *slice = new KVSlice(key, key_len, data, length, true,
+                                 sbMgr_->GetDigestType());
+    Request *req = new Request(*slice);
+    req->SetWriteOptions(wopts);
+    //runs on the segment write thread once the segment is written
+    req->SetDone([this, slice, cb](Request* done_req) {
+        Status st = updateMeta(done_req);
+        delete done_req;
+        delete slice;
+        cb(st);
+    });
+    chooseShard(*slice)->reqQue.Enqueue_Notify(req);
+}
+
+std::future<Status> KVDS::InsertAsync(const char* key, uint32_t key_len,
+                                      const char* data, uint16_t length,
+                                      const WriteOptions& wopts) {
+    std::shared_ptr<std::promise<Status> > p =
+            std::make_shared<std::promise<Status> >();
+    InsertAsync(key, key_len, data, length,
+                [p](const Status& s) { p->set_value(s); }, wopts);
+    return p->get_future();
+}
+
+void KVDS::DeleteAsync(const char* key, uint32_t key_len, WriteCallback cb,
+                       const WriteOptions& wopts) {
+    InsertAsync(key, key_len, NULL, 0, cb, wopts);
+}
+
+std::future<Status> KVDS::DeleteAsync(const char* key, uint32_t key_len,
+                                      const WriteOptions& wopts) {
+    return InsertAsync(key, key_len, NULL, 0, wopts);
+}
+
+void KVDS::GetAsync(const char* key, uint32_t key_len, ReadCallback cb) {
+    if (key == NULL) {
+        cb(Status::InvalidArgument("Key is null."), string());
+        return;
+    }
+    ReadReq *req = new ReadReq;
+    req->key.assign(key, key_len);
+    req->cb = cb;
+    readQue_.Enqueue_Notify(req);
+}
+
+std::future<Status> KVDS::GetAsync(const char* key, uint32_t key_len,
+                                   string &data) {
+    std::shared_ptr<std::promise<Status> > p =
+            std::make_shared<std::promise<Status> >();
+    string *out = &data;
+    GetAsync(key, key_len, [p, out](const Status& s, const string& value) {
+        *out = value;
+        p->set_value(s);
+    });
+    return p->get_future();
+}
+
 Status KVDS::InsertBatch(WriteBatch *batch)
 {
     if (batch->batch_.empty()) {
@@ -402,24 +600,35 @@ Status KVDS::InsertBatch(WriteBatch *batch)
         }
     }
 
+    //the digest function is only known once the batch meets the DB
+    KVSlice::ComputeDigests(batch->batch_, sbMgr_->GetDigestType());
+
     SegForSlice *seg = new SegForSlice(segMgr_, idxMgr_, bdev_);
+    //the batch may be applied after later segments, their deletes wait
+    uint64_t first_seq = sealedNextSeqNum();
     for (std::list<KVSlice *>::iterator iter = batch->batch_.begin();
             iter != batch->batch_.end(); iter++) {
         if (seg->TryPut(*iter)) {
+            (*iter)->SetSeqNum(iter == batch->batch_.begin() ? first_seq
+                    : idxMgr_->NextSeqNum());
             seg->Put(*iter);
         }
         else {
             __ERROR("The Batch is too large, can't put in one segment");
+            segApplied(first_seq);
             delete seg;
             return Status::Aborted("Batch is too large.");
         }
     }
 
     seg->SetSegId(seg_id);
+    seg->SetSeqNum(idxMgr_->NextSegSeqNum());
     ret = seg->WriteSegToDevice();
     if(!ret) {
         __ERROR("Write batch segment to device failed");
         segMgr_->FreeForFailed(seg_id);
+        idxMgr_->SegApplied(seg->GetSeqNum());
+        segApplied(first_seq);
         delete seg;
         return Status::IOError("could not write batch segment to device ");
     }
@@ -427,17 +636,19 @@ Status KVDS::InsertBatch(WriteBatch *batch)
     uint32_t free_size = seg->GetFreeSize();
     segMgr_->Use(seg_id, free_size);
     seg->UpdateToIndex();
+    idxMgr_->SegApplied(seg->GetSeqNum());
+    segApplied(first_seq);
     delete seg;
     return Status::OK();
 }
 
-Status KVDS::insertKey(KVSlice& slice) {
-    Request *req = new Request(slice);
-    reqQue_.Enqueue_Notify(req);
-    req->Wait();
-    Status s = updateMeta(req);
-    delete req;
-    return s;
+Status KVDS::insertKey(KVSlice& slice, const WriteOptions& wopts) {
+    //the call waits for the write, so the request lives on its stack
+    Request req(slice);
+    req.SetWriteOptions(wopts);
+    chooseShard(slice)->reqQue.Enqueue_Notify(&req);
+    req.Wait();
+    return updateMeta(&req);
 }
 
 Status KVDS::updateMeta(Request *req) {
@@ -451,6 +662,9 @@ Status KVDS::updateMeta(Request *req) {
     // minus the segment delete counter
     SegForReq *seg = req->GetSeg();
     if (!seg->CommitedAndGetNum()) {
+        //all requests of the segment are in the index now
+        idxMgr_->SegApplied(seg->GetSeqNum());
+        segApplied(seg->GetFirstSeqNum());
         segReaperQue_.Enqueue_Notify(seg);
     }
     return Status::OK();
@@ -503,32 +717,214 @@ Status KVDS::readData(KVSlice &slice, string &data) {
     return Status::OK();
 }
 
-void KVDS::ReqMergeThdEntry() {
-    __DEBUG("Requests Merge thread start!!");
-    std::unique_lock < std::mutex > lck_seg(segMtx_, std::defer_lock);
+Status KVDS::readLean(KVSlice &slice, string &data) {
+    vector<HashEntry> entries;
+    idxMgr_->GetLeanEntries(&slice, entries);
+
+    for (vector<HashEntry>::iterator iter = entries.begin();
+            iter != entries.end(); iter++) {
+        //header, key and data are in a row, unless the data is aligned
+        //at the segment tail, read them at once
+        uint64_t header_offset = iter->GetHeaderOffsetPhy();
+        uint16_t data_len = iter->GetDataSize();
+        size_t length = IndexManager::SizeOfDataHeader() + slice.GetKeyLen();
+        if (data_len != ALIGNED_SIZE) {
+            length += data_len;
+        }
+        char *mdata = new char[length];
+        if (bdev_->pRead(mdata, length, header_offset) != (ssize_t) length) {
+            __ERROR("Could not read record at position");
+            delete[] mdata;
+            return Status::IOError("Could not read record at position.");
+        }
+
+        DataHeader *header = (DataHeader *) mdata;
+        if (!(header->GetDigest() == slice.GetDigest())) {
+            //another key of the same fingerprint
+            delete[] mdata;
+            continue;
+        }
+        HashEntry entry(*header, header_offset);
+        slice.SetHashEntry(&entry);
+        if (data_len == 0) {
+            delete[] mdata;
+            return Status::NotFound("Key is not found.");
+        }
+
+        uint64_t data_offset = 0;
+        if (!segMgr_->ComputeDataOffsetPhyFromEntry(&entry, data_offset)) {
+            delete[] mdata;
+            return Status::Aborted("Compute data offset failed.");
+        }
+        if (data_offset < header_offset
+                || data_offset + data_len > header_offset + length) {
+            delete[] mdata;
+            return readData(slice, data);
+        }
+        data.assign(&mdata[data_offset - header_offset], data_len);
+        delete[] mdata;
+        return Status::OK();
+    }
+
+    return Status::NotFound("Key is not found.");
+}
+
+KVDS::ReqShard* KVDS::chooseShard(const KVSlice& slice) {
+    //by the hash bits of the index partition, so a shard feeds the
+    //partitions of one node when the shards are a multiple of them
+    uint32_t hash = KeyDigestHandle::Hash(&slice.GetDigest());
+    return shards_[(hash / INDEX_NUMA_CHUNK) % shards_.size()];
+}
+
+void KVDS::ReqMergeThdEntry(uint32_t shard_no) {
+    __DEBUG("Requests Merge thread %u start!!", shard_no);
+    uint32_t nodes = idxMgr_->GetNumaNodes();
+    if (nodes > 1) {
+        KVNuma::BindThread(shard_no % nodes % KVNuma::NodeNum());
+    }
+    ReqShard *shard = shards_[shard_no];
+    Request *reqs[REQ_MERGE_BATCH];
+
+    //Group commit. Once the queue drains, the open segment is flushed at
+    //once, unless requests have been coming to open segments faster than
+    //expired_time / GROUP_COMMIT_GAP_FACTOR. Then it waits for
+    //GROUP_COMMIT_GAP_FACTOR gaps more, within expired_time. gap is the
+    //average of the arrival gaps seen, in microseconds
+    int64_t max_wait = options_.expired_time;
+    int64_t gap = max_wait;
+    KVTime last_arrival;
     while (!reqMergeT_stop_.load()) {
-        Request *req = reqQue_.Wait_Dequeue();
-        if (req) {
-            lck_seg.lock();
-            if (seg_->TryPut(req)) {
-                seg_->Put(req);
-            } else {
-                seg_->Complete();
-                segWriteQue_.Enqueue_Notify(seg_);
-                seg_ = new SegForReq(segMgr_, idxMgr_, bdev_,
-                                    options_.expired_time);
-                seg_->Put(req);
+        uint32_t num;
+        if (!shard->seg->GetKeyNum()) {
+            num = shard->reqQue.Wait_DequeueBatch(reqs, REQ_MERGE_BATCH);
+        } else if (shard->seg->GetTimeLeft() <= 0) {
+            //a request in it is due, even if more keep coming
+            flushShard(shard);
+            continue;
+        } else {
+            int64_t wait = std::min(gap * GROUP_COMMIT_GAP_FACTOR,
+                                    shard->seg->GetTimeLeft());
+            if (gap * GROUP_COMMIT_GAP_FACTOR > max_wait || wait <= 0) {
+                wait = 0;
+            }
+            num = shard->reqQue.Wait_DequeueBatchFor(reqs, REQ_MERGE_BATCH,
+                                                     wait);
+            if (!num) {
+                //nothing more came, waiting longer is not worth it
+                flushShard(shard);
+                if (wait) {
+                    gap += (max_wait - gap) / GROUP_COMMIT_EWMA_WEIGHT;
+                }
+                continue;
             }
-            lck_seg.unlock();
         }
+        if (!num) {
+            continue;
+        }
+
+        KVTime now;
+        if (shard->seg->GetKeyNum()) {
+            int64_t sample = (now - last_arrival) / num;
+            gap += (sample - gap) / GROUP_COMMIT_EWMA_WEIGHT;
+        }
+        last_arrival = now;
 
+        putToShard(shard, reqs, num);
     } __DEBUG("Requests Merge thread stop!!");
 }
 
+void KVDS::putToShard(ReqShard* shard, Request** reqs, uint32_t num) {
+    for (uint32_t i = 0; i < num; i++) {
+        Request *req = reqs[i];
+        if (!shard->seg->TryPut(req)) {
+            if (shard->seg->GetKeyNum()) {
+                flushShard(shard);
+            }
+            if (!shard->seg->TryPut(req)) {
+                //not even an empty segment takes it, fail it now
+                __ERROR("Cann't put request key = %s to a segment",
+                        req->GetSlice().GetKeyStr().c_str());
+                req->SetWriteStat(false);
+                req->Signal();
+                continue;
+            }
+        }
+        shard->seg->Put(req);
+    }
+}
+
+void KVDS::drainShard(ReqShard* shard) {
+    Request *reqs[REQ_MERGE_BATCH];
+    uint32_t num;
+    while ((num = shard->reqQue.Wait_DequeueBatchFor(reqs, REQ_MERGE_BATCH,
+                                                     0)) != 0) {
+        putToShard(shard, reqs, num);
+    }
+    if (shard->seg->GetKeyNum()) {
+        flushShard(shard);
+    }
+}
+
+void KVDS::flushShard(ReqShard* shard) {
+    shard->seg->Complete();
+    segSealed(shard->seg->GetFirstSeqNum());
+    if (shard->seg->IsUrgent()) {
+        segUrgentQue_.Enqueue_Notify(shard->seg);
+    } else {
+        segWriteQue_.Enqueue_Notify(shard->seg);
+    }
+    shard->seg = newSegForReq();
+}
+
+SegForReq* KVDS::newSegForReq() {
+    {
+        std::lock_guard<std::mutex> l(segPoolMtx_);
+        if (!segPool_.empty()) {
+            SegForReq *seg = segPool_.back();
+            segPool_.pop_back();
+            return seg;
+        }
+    }
+    return new SegForReq(segMgr_, idxMgr_, bdev_, options_.expired_time);
+}
+
+void KVDS::recycleSeg(SegForReq* seg) {
+    seg->Reset(options_.expired_time);
+    {
+        std::lock_guard<std::mutex> l(segPoolMtx_);
+        if (segPool_.size() < segPoolMax_) {
+            segPool_.push_back(seg);
+            return;
+        }
+    }
+    delete seg;
+}
+
+SegForReq* KVDS::dequeueSegToWrite() {
+    SegForReq *seg = segUrgentQue_.Dequeue();
+    return seg ? seg : segWriteQue_.Dequeue();
+}
+
+SegForReq* KVDS::waitSegToWrite() {
+    SegForReq *seg = dequeueSegToWrite();
+    if (seg) {
+        return seg;
+    }
+    //both queues notify segQueEvent_
+    uint64_t key = segQueEvent_.PrepareWait();
+    seg = dequeueSegToWrite();
+    if (seg) {
+        segQueEvent_.CancelWait();
+    } else if (segQueEvent_.Wait(key, 1000000)) {
+        seg = dequeueSegToWrite();
+    }
+    return seg;
+}
+
 void KVDS::SegWriteThdEntry() {
     __DEBUG("Segment write thread start!!");
     while (!segWriteT_stop_) {
-        SegForReq *seg = segWriteQue_.Wait_Dequeue();
+        SegForReq *seg = waitSegToWrite();
         if (seg) {
             uint32_t seg_id = 0;
             bool res;
@@ -542,11 +938,17 @@ void KVDS::SegWriteThdEntry() {
 
             uint32_t free_size = seg->GetFreeSize();
             seg->SetSegId(seg_id);
+            seg->SetSeqNum(idxMgr_->NextSegSeqNum());
             res = seg->WriteSegToDevice();
+            //the requests may reap the segment once notified
+            seg->ReleaseDataBuf();
             if (res) {
                 segMgr_->Use(seg_id, free_size);
             } else {
                 segMgr_->FreeForFailed(seg_id);
+                //no request of it reaches the index
+                idxMgr_->SegApplied(seg->GetSeqNum());
+                segApplied(seg->GetFirstSeqNum());
             }
             seg->Notify(res);
 
@@ -557,47 +959,87 @@ void KVDS::SegWriteThdEntry() {
     } __DEBUG("Segment write thread stop!!");
 }
 
-void KVDS::SegTimeoutThdEntry() {
-    __DEBUG("Segment Timeout thread start!!");
-    std::unique_lock < std::mutex > lck(segMtx_, std::defer_lock);
-    while (!segTimeoutT_stop_) {
-        lck.lock();
-        if (seg_->IsExpired()) {
-            seg_->Complete();
-
-            segWriteQue_.Enqueue_Notify(seg_);
-            seg_ = new SegForReq(segMgr_, idxMgr_, bdev_,
-                                options_.expired_time);
-        }
-        lck.unlock();
-
-        usleep(options_.expired_time);
-    } __DEBUG("Segment Timeout thread stop!!");
-}
-
 void KVDS::SegReaperThdEntry() {
     __DEBUG("Segment reaper thread start!!");
 
+    //segments whose deletes wait for older segments
+    std::list<SegForReq*> segs;
     while (!segReaperT_stop_) {
-        SegForReq *seg = segReaperQue_.Wait_Dequeue();
+        SegForReq *seg = segReaperQue_.Wait_Dequeue(
+                segs.empty() ? 1000 : SEG_REAP_RETRY_MSEC);
         if (seg) {
-            seg->CleanDeletedEntry();
-            __DEBUG("Segment reaper delete seg_id = %d", seg->GetSegId());
-            delete seg;
+            segs.push_back(seg);
         }
+        reapSegs(segs, false);
     } __DEBUG("Segment write thread stop!!");
 
     //Clean the Queue
-    while (!segReaperQue_.empty()) {
-        SegForReq *seg = segReaperQue_.Wait_Dequeue();
-        if (seg) {
-            seg->CleanDeletedEntry();
-            __DEBUG("Segment reaper delete seg_id = %d", seg->GetSegId());
-            delete seg;
+    SegForReq *seg;
+    while ((seg = segReaperQue_.Dequeue()) != NULL) {
+        segs.push_back(seg);
+    }
+    reapSegs(segs, true);
+}
+
+void KVDS::reapSegs(std::list<SegForReq*>& segs, bool force) {
+    for (std::list<SegForReq*>::iterator iter = segs.begin();
+            iter != segs.end();) {
+        SegForReq *seg = *iter;
+        if (!force && !olderSegsApplied(seg)) {
+            iter++;
+            continue;
         }
+        seg->CleanDeletedEntry();
+        __DEBUG("Segment reaper recycle seg_id = %d", seg->GetSegId());
+        recycleSeg(seg);
+        iter = segs.erase(iter);
     }
 }
 
+void KVDS::segSealed(uint64_t first_seq) {
+    std::lock_guard<std::mutex> l(unappliedMtx_);
+    unappliedSegs_.insert(first_seq);
+}
+
+uint64_t KVDS::sealedNextSeqNum() {
+    std::lock_guard<std::mutex> l(unappliedMtx_);
+    uint64_t seq = idxMgr_->NextSeqNum();
+    unappliedSegs_.insert(seq);
+    return seq;
+}
+
+void KVDS::segApplied(uint64_t first_seq) {
+    std::lock_guard<std::mutex> l(unappliedMtx_);
+    std::multiset<uint64_t>::iterator iter = unappliedSegs_.find(first_seq);
+    if (iter != unappliedSegs_.end()) {
+        unappliedSegs_.erase(iter);
+    }
+}
+
+bool KVDS::allSegsApplied() {
+    std::lock_guard<std::mutex> l(unappliedMtx_);
+    return unappliedSegs_.empty();
+}
+
+bool KVDS::olderSegsApplied(SegForReq* seg) {
+    std::lock_guard<std::mutex> l(unappliedMtx_);
+    return unappliedSegs_.empty()
+            || *unappliedSegs_.begin() > seg->GetFirstSeqNum();
+}
+
+void KVDS::ReadThdEntry() {
+    __DEBUG("Read thread start!!");
+    while (!readT_stop_) {
+        ReadReq *req = readQue_.Wait_Dequeue();
+        if (req) {
+            string data;
+            Status s = Get(req->key.c_str(), req->key.size(), data);
+            req->cb(s, data);
+            delete req;
+        }
+    } __DEBUG("Read thread stop!!");
+}
+
 void KVDS::Do_GC() {
     __INFO("Application call GC!!!!!");
     return gcMgr_->FullGC();
@@ -610,5 +1052,22 @@ void KVDS::GCThdEntry() {
         usleep(1000000);
     } __DEBUG("GC thread stop!!");
 }
+
+void KVDS::CkptThdEntry() {
+    __DEBUG("Checkpoint thread start!!");
+    //sleep in short steps to stop quickly
+    int steps = 0;
+    while (!ckptT_stop_) {
+        usleep(100000);
+        //dirty pages of the paged index may not wait for the interval
+        if ((options_.checkpoint_interval <= 0
+                || ++steps < options_.checkpoint_interval * 10)
+                && !idxMgr_->NeedWriteback()) {
+            continue;
+        }
+        steps = 0;
+        ckptMgr_->BackCheckpoint();
+    } __DEBUG("Checkpoint thread stop!!");
+}
 }
 
@@ -5,11 +5,20 @@ namespace hlkvds {
 
 Options::Options() :
     segment_size(SEGMENT_SIZE),
-            hashtable_size(0),
+            hashtable_size(0), digest_type(DIGEST_RMD160),
+            index_mode(INDEX_MODE_FULL),
             //data_aligned_size(ALIGNED_SIZE),
             expired_time(EXPIRED_TIME), seg_write_thread(SEG_WRITE_THREAD),
+            req_merge_thread(REQ_MERGE_THREAD), read_thread(READ_THREAD),
             seg_full_rate(SEG_FULL_RATE), gc_upper_level(GC_UPPER_LEVEL),
-            gc_lower_level(GC_LOWER_LEVEL) {
+            gc_lower_level(GC_LOWER_LEVEL),
+            checkpoint_interval(CHECKPOINT_INTERVAL),
+            index_cache_pages(INDEX_CACHE_PAGES),
+            index_lock_num(INDEX_LOCK_NUM), index_numa_nodes(0) {
+}
+
+WriteOptions::WriteOptions() :
+    max_latency(0), urgent(false) {
 }
 
 } //namespace hlkvds
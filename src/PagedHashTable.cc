@@ -0,0 +1,227 @@
+#include "PagedHashTable.h"
+
+namespace hlkvds {
+
+PagedHashTable::PagedHashTable(IndexManager* im, uint32_t cache_pages,
+                               uint32_t lock_num) :
+    idxMgr_(im), capacity_(cache_pages ? cache_pages : 1), locks_(NULL),
+            lockNum_(1), dirtyNum_(0), pinNum_(0) {
+    //a power of 2, the keys of a lock are not tied to a page
+    while (lockNum_ < (1U << 31) && (lockNum_ << 1) <= lock_num) {
+        lockNum_ <<= 1;
+    }
+    locks_ = new std::mutex[lockNum_];
+    pages_.assign(GetBucketNum(), NULL);
+}
+
+PagedHashTable::~PagedHashTable() {
+    for (list<Page*>::iterator iter = lru_.begin(); iter != lru_.end(); iter++) {
+        delete *iter;
+    }
+    delete[] locks_;
+}
+
+uint32_t PagedHashTable::GetBucketNum() const {
+    return IndexManager::computeRangeNum(idxMgr_->htSize_);
+}
+
+uint32_t PagedHashTable::pageNo(const Kvdb_Digest& digest) const {
+    return idxMgr_->computeSlotNo(&digest)
+            / IndexManager::rangeSlotNum(idxMgr_->htSize_);
+}
+
+int PagedHashTable::find(Page* page, const Kvdb_Digest& digest) {
+    for (uint32_t i = 0; i < page->entries.size(); i++) {
+        if (page->entries[i].GetKeyDigest() == digest) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+PagedHashTable::Page* PagedHashTable::getPage(uint32_t no) {
+    std::unique_lock<std::mutex> l(cacheMtx_);
+    //the layout changed since no was taken
+    if (no >= pages_.size()) {
+        return NULL;
+    }
+    Page *page = pages_[no];
+    if (!page) {
+        page = new Page;
+        page->no = no;
+        page->loaded = false;
+        page->version = 0;
+        page->dirty = false;
+        page->pins = 0;
+        lru_.push_front(page);
+        page->lruIter = lru_.begin();
+        pages_[no] = page;
+    } else {
+        lru_.splice(lru_.begin(), lru_, page->lruIter);
+    }
+    page->pins++;
+    pinNum_++;
+    evict();
+    l.unlock();
+
+    page->mtx.lock();
+    if (!page->loaded) {
+        page->entries.clear();
+        page->loaded = idxMgr_->loadPage(no, page->entries);
+        if (!page->loaded) {
+            page->mtx.unlock();
+            unpin(page);
+            return NULL;
+        }
+    }
+    return page;
+}
+
+void PagedHashTable::putPage(Page* page, bool changed) {
+    if (changed) {
+        std::lock_guard<std::mutex> l(cacheMtx_);
+        page->version++;
+        if (!page->dirty) {
+            page->dirty = true;
+            dirtyNum_++;
+        }
+    }
+    page->mtx.unlock();
+    unpin(page);
+}
+
+void PagedHashTable::unpin(Page* page) {
+    std::lock_guard<std::mutex> l(cacheMtx_);
+    page->pins--;
+    if (--pinNum_ == 0) {
+        cacheCv_.notify_all();
+    }
+    evict();
+}
+
+void PagedHashTable::evict() {
+    list<Page*>::iterator iter = lru_.end();
+    while (lru_.size() > capacity_ && iter != lru_.begin()) {
+        iter--;
+        Page *page = *iter;
+        if (page->pins || page->dirty) {
+            continue;
+        }
+        pages_[page->no] = NULL;
+        iter = lru_.erase(iter);
+        delete page;
+    }
+}
+
+void PagedHashTable::GetEntries(uint32_t no, vector<HashEntry>& entries) {
+    Page *page = getPage(no);
+    if (!page) {
+        return;
+    }
+    entries.insert(entries.end(), page->entries.begin(), page->entries.end());
+    putPage(page, false);
+}
+
+bool PagedHashTable::Get(const Kvdb_Digest& digest, HashEntry& entry) {
+    Page *page = getPage(pageNo(digest));
+    if (!page) {
+        return false;
+    }
+    int pos = find(page, digest);
+    if (pos >= 0) {
+        entry = page->entries[pos];
+    }
+    putPage(page, false);
+    return pos >= 0;
+}
+
+bool PagedHashTable::Put(const HashEntry& entry) {
+    Kvdb_Digest digest = entry.GetKeyDigest();
+    Page *page = getPage(pageNo(digest));
+    if (!page) {
+        __ERROR("Could not read the index page to put an entry");
+        return false;
+    }
+    int pos = find(page, digest);
+    if (pos >= 0) {
+        page->entries[pos] = entry;
+    } else {
+        page->entries.push_back(entry);
+    }
+    putPage(page, true);
+    return pos < 0;
+}
+
+bool PagedHashTable::Remove(const Kvdb_Digest& digest) {
+    Page *page = getPage(pageNo(digest));
+    if (!page) {
+        __ERROR("Could not read the index page to remove an entry");
+        return false;
+    }
+    int pos = find(page, digest);
+    if (pos >= 0) {
+        page->entries[pos] = page->entries.back();
+        page->entries.pop_back();
+    }
+    putPage(page, pos >= 0);
+    return pos >= 0;
+}
+
+bool PagedHashTable::Snapshot(uint32_t no, vector<HashEntry>& entries,
+                              uint64_t& version) {
+    Page *page = getPage(no);
+    if (!page) {
+        return false;
+    }
+    entries.insert(entries.end(), page->entries.begin(), page->entries.end());
+    version = page->version;
+    putPage(page, false);
+    return true;
+}
+
+void PagedHashTable::SetClean(uint32_t no, uint64_t version) {
+    std::lock_guard<std::mutex> l(cacheMtx_);
+    if (no >= pages_.size()) {
+        return;
+    }
+    Page *page = pages_[no];
+    if (page && page->dirty && page->version == version) {
+        page->dirty = false;
+        dirtyNum_--;
+        evict();
+    }
+}
+
+uint32_t PagedHashTable::GetDirtyPageNum() const {
+    std::lock_guard<std::mutex> l(cacheMtx_);
+    return dirtyNum_;
+}
+
+bool PagedHashTable::NeedWriteback() const {
+    return GetDirtyPageNum() >= (capacity_ + 1) / 2;
+}
+
+void PagedHashTable::LockAll() {
+    for (uint32_t i = 0; i < lockNum_; i++) {
+        locks_[i].lock();
+    }
+}
+
+void PagedHashTable::UnlockAll() {
+    for (uint32_t i = 0; i < lockNum_; i++) {
+        locks_[i].unlock();
+    }
+}
+
+void PagedHashTable::Clear() {
+    std::unique_lock<std::mutex> l(cacheMtx_);
+    cacheCv_.wait(l, [this] { return pinNum_ == 0; });
+    for (list<Page*>::iterator iter = lru_.begin(); iter != lru_.end(); iter++) {
+        delete *iter;
+    }
+    lru_.clear();
+    dirtyNum_ = 0;
+    pages_.assign(GetBucketNum(), NULL);
+}
+
+}// namespace hlkvds
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <stdlib.h>
+#include <thread>
+#include <algorithm>
+
+#include "RecoveryManager.h"
+
+namespace hlkvds {
+
+RecoveryManager::RecoveryManager(BlockDevice* bdev, IndexManager* im,
+                                 SegmentManager* sm, Options &opt) :
+    segMgr_(sm), idxMgr_(im), bdev_(bdev), options_(opt), nextSegId_(0),
+            failed_(false) {
+}
+
+RecoveryManager::~RecoveryManager() {
+}
+
+bool RecoveryManager::Recover(uint64_t checkpoint_seq) {
+    uint32_t seg_num = segMgr_->GetNumberOfSeg();
+    rewritten_.assign(seg_num, false);
+
+    __INFO("Begin recovery, scan %u segments written since sequence number %lu",
+           seg_num, checkpoint_seq);
+
+    vector<std::thread> thds;
+    for (int i = 0; i < RECOVERY_THREAD_NUM; i++) {
+        thds.push_back(std::thread(&RecoveryManager::scanThdEntry, this,
+                                   checkpoint_seq));
+    }
+    for (auto &th : thds) {
+        th.join();
+    }
+    if (failed_.load()) {
+        __ERROR("Recovery could not read segments from device");
+        return false;
+    }
+
+    uint32_t dropped = idxMgr_->DropEntriesInSegs(rewritten_);
+
+    for (vector<uint32_t>::iterator iter = tornSegs_.begin();
+            iter != tornSegs_.end(); iter++) {
+        segMgr_->FreeForRecovery(*iter);
+    }
+
+    //Records of a GC copy keep their sequence number, a later segment
+    //holds the later copy, so replay segments in write order
+    std::sort(scans_.begin(), scans_.end(),
+              [](const SegScan& a, const SegScan& b) {
+                  return a.seqNum < b.seqNum;
+              });
+
+    //Set every segment up before replay, superseded records are accounted
+    //as death size of the segment they are in
+    for (vector<SegScan>::iterator iter = scans_.begin(); iter != scans_.end();
+            iter++) {
+        segMgr_->UseForRecovery(iter->segId, iter->freeSize);
+    }
+
+    uint64_t max_seq = checkpoint_seq;
+    uint32_t record_num = 0;
+    vector<HashEntry> del_entries;
+    for (vector<SegScan>::iterator iter = scans_.begin(); iter != scans_.end();
+            iter++) {
+        max_seq = std::max(max_seq, iter->seqNum);
+        for (vector<HashEntry>::iterator e_iter = iter->entries.begin();
+                e_iter != iter->entries.end(); e_iter++) {
+            max_seq = std::max(max_seq, e_iter->GetSeqNum());
+            idxMgr_->UpdateIndex(*e_iter);
+            if (e_iter->GetDataSize() == 0) {
+                del_entries.push_back(*e_iter);
+            }
+            record_num++;
+        }
+    }
+
+    //Delete records only mark a key deleted, now every record is replayed
+    for (vector<HashEntry>::iterator iter = del_entries.begin();
+            iter != del_entries.end(); iter++) {
+        idxMgr_->RemoveEntry(*iter);
+    }
+
+    idxMgr_->AdvanceSeqNum(max_seq);
+
+    __INFO("Finish recovery, replayed %u records in %lu segments, "
+           "dropped %u stale entries, freed %lu torn segments",
+           record_num, scans_.size(), dropped, tornSegs_.size());
+    return true;
+}
+
+void RecoveryManager::scanThdEntry(uint64_t checkpoint_seq) {
+    uint32_t seg_size = segMgr_->GetSegmentSize();
+    char *buf = (char *) KVHugeMem::Alloc(seg_size);
+    if (!buf) {
+        failed_.store(true);
+        return;
+    }
+
+    uint32_t seg_num = segMgr_->GetNumberOfSeg();
+    uint32_t seg_id;
+    while (!failed_.load() && (seg_id = nextSegId_.fetch_add(1)) < seg_num) {
+        if (!scanSegment(seg_id, checkpoint_seq, buf)) {
+            failed_.store(true);
+        }
+    }
+    KVHugeMem::Free(buf, seg_size);
+}
+
+bool RecoveryManager::scanSegment(uint32_t seg_id, uint64_t checkpoint_seq,
+                                  char* buf) {
+    //the index written by a checkpoint has no segment header
+    if (segMgr_->IsIndexSeg(seg_id)) {
+        return true;
+    }
+
+    uint64_t seg_offset;
+    segMgr_->ComputeSegOffsetFromId(seg_id, seg_offset);
+
+    SegmentOnDisk seg_disk;
+    ssize_t length = SegmentManager::SizeOfSegOnDisk();
+    if (bdev_->pRead(&seg_disk, length, seg_offset) != length) {
+        __ERROR("Recovery read segment header error, seg_id = %u", seg_id);
+        return false;
+    }
+    if (seg_disk.seq_num < checkpoint_seq) {
+        return true;
+    }
+
+    uint32_t seg_size = segMgr_->GetSegmentSize();
+    if (bdev_->pRead(buf, seg_size, seg_offset) != (ssize_t) seg_size) {
+        __ERROR("Recovery read segment error, seg_id = %u", seg_id);
+        return false;
+    }
+
+    SegScan scan;
+    scan.segId = seg_id;
+    scan.seqNum = seg_disk.seq_num;
+    scan.freeSize = 0;
+
+    uint32_t checksum = seg_disk.checksum;
+    ((SegmentOnDisk *) buf)->checksum = 0;
+    bool valid = (KVCrc::Crc32c(0, buf, seg_size) == checksum)
+            && loadSegEntries(scan, seg_disk, seg_offset, buf);
+
+    std::lock_guard<std::mutex> l(mtx_);
+    rewritten_[seg_id] = true;
+    if (valid) {
+        scans_.push_back(std::move(scan));
+    } else {
+        __WARN("Segment is torn, seg_id = %u", seg_id);
+        tornSegs_.push_back(seg_id);
+    }
+    return true;
+}
+
+bool RecoveryManager::loadSegEntries(SegScan& scan,
+                                     const SegmentOnDisk& seg_disk,
+                                     uint64_t seg_offset, const char* buf) {
+    uint32_t seg_size = segMgr_->GetSegmentSize();
+    uint32_t head_offset = SegmentManager::SizeOfSegOnDisk();
+    uint32_t tail_offset = seg_size;
+
+    for (uint32_t index = 0; index < seg_disk.number_keys; index++) {
+        if (head_offset + IndexManager::SizeOfDataHeader() > tail_offset) {
+            return false;
+        }
+        //packed as on device, copied out by its copy constructor
+        DataHeader header = *(const DataHeader *) &buf[head_offset];
+
+        uint32_t next_offset = header.GetNextHeadOffset();
+        if (next_offset <= head_offset || next_offset > tail_offset) {
+            return false;
+        }
+        if (header.GetDataSize() == ALIGNED_SIZE) {
+            tail_offset -= ALIGNED_SIZE;
+        }
+
+        scan.entries.push_back(HashEntry(header, seg_offset + head_offset));
+        head_offset = next_offset;
+    }
+    if (head_offset > tail_offset) {
+        return false;
+    }
+    scan.freeSize = tail_offset - head_offset;
+    return true;
+}
+
+}//namespace hlkvds
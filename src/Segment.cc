@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <vector>
 
 #include "Segment.h"
 
@@ -11,7 +12,7 @@ namespace hlkvds {
 
 KVSlice::KVSlice() :
     key_(NULL), keyLength_(0), data_(NULL), dataLength_(0), digest_(NULL),
-            entry_(NULL), segId_(0) {
+            entry_(NULL), segId_(0), seqNum_(0), deepCopy_(false) {
 }
 
 KVSlice::~KVSlice() {
@@ -19,17 +20,11 @@ KVSlice::~KVSlice() {
         delete[] key_;
         delete[] data_;
     }
-    if (digest_) {
-        delete digest_;
-    }
-    if (entry_) {
-        delete entry_;
-    }
 }
 
 KVSlice::KVSlice(const KVSlice& toBeCopied) :
     key_(NULL), keyLength_(0), data_(NULL), dataLength_(0), digest_(NULL),
-            entry_(NULL), segId_(0), deepCopy_(false) {
+            entry_(NULL), segId_(0), seqNum_(0), deepCopy_(false) {
     copy_helper(toBeCopied);
 }
 
@@ -43,61 +38,96 @@ void KVSlice::copy_helper(const KVSlice& toBeCopied) {
     dataLength_ = toBeCopied.GetDataLen();
     key_ = toBeCopied.GetKey();
     data_ = toBeCopied.GetData();
-    *digest_ = *toBeCopied.digest_;
-    *entry_ = *toBeCopied.entry_;
+    digest_ = NULL;
+    if (toBeCopied.digest_) {
+        digestBuf_ = *toBeCopied.digest_;
+        digest_ = &digestBuf_;
+    }
+    entry_ = NULL;
+    if (toBeCopied.entry_) {
+        entryBuf_ = *toBeCopied.entry_;
+        entry_ = &entryBuf_;
+    }
     segId_ = toBeCopied.segId_;
+    seqNum_ = toBeCopied.seqNum_;
     deepCopy_ = toBeCopied.deepCopy_;
 }
 
-KVSlice::KVSlice(const char* key, int key_len, const char* data, int data_len, bool deep_copy) :
+KVSlice::KVSlice(const char* key, int key_len, const char* data, int data_len,
+                 bool deep_copy, int digest_type) :
     key_(NULL), keyLength_(key_len), data_(NULL), dataLength_(data_len),
-            digest_(NULL), entry_(NULL), segId_(0), deepCopy_(deep_copy) {
+            digest_(NULL), entry_(NULL), segId_(0), seqNum_(0), deepCopy_(deep_copy) {
     if (deepCopy_) {
         key_ = new char[key_len];
-        data_ = new char[data_len];
         memcpy((void*)key_, key, key_len);
-        memcpy((void*)data_, data, data_len);
+        //a delete has no data
+        if (data) {
+            data_ = new char[data_len];
+            memcpy((void*)data_, data, data_len);
+        }
     } else {
         key_ = key;
         data_ = data;
     }
-    computeDigest();
+    if (digest_type != NO_DIGEST) {
+        computeDigest(digest_type);
+    }
 }
 
 #ifdef WITH_ITERATOR
 KVSlice::KVSlice(Kvdb_Digest *digest, const char* key, int key_len,
                 const char* data, int data_len) :
     key_(key), keyLength_(key_len), data_(data), dataLength_(data_len),
-            digest_(NULL), entry_(NULL), segId_(0), deepCopy_(false) {
-    digest_ = new Kvdb_Digest(*digest);
+            digest_(&digestBuf_), entry_(NULL), digestBuf_(*digest), segId_(0),
+            seqNum_(0), deepCopy_(false) {
 }
 #else
 KVSlice::KVSlice(Kvdb_Digest *digest, const char* data, int data_len) :
     key_(NULL), keyLength_(0), data_(data), dataLength_(data_len),
-            digest_(NULL), entry_(NULL), segId_(0) {
-    digest_ = new Kvdb_Digest(*digest);
+            digest_(&digestBuf_), entry_(NULL), digestBuf_(*digest), segId_(0),
+            seqNum_(0), deepCopy_(false) {
 }
 #endif
 
 
 void KVSlice::SetKeyValue(const char* key, int key_len, const char* data,
-                          int data_len) {
+                          int data_len, int digest_type) {
     keyLength_ = key_len;
     dataLength_ = data_len;
     key_ = key;
     data_ = data;
 
-    computeDigest();
+    computeDigest(digest_type);
 }
 
-void KVSlice::computeDigest() {
-    if (digest_) {
-        delete digest_;
-        digest_=nullptr;
+void KVSlice::ComputeDigest(int digest_type) {
+    computeDigest(digest_type);
+}
+
+void KVSlice::ComputeDigests(std::list<KVSlice *> &slices, int digest_type) {
+    std::vector<Kvdb_Key> keys;
+    keys.reserve(slices.size());
+    for (std::list<KVSlice *>::iterator iter = slices.begin();
+            iter != slices.end(); iter++) {
+        keys.push_back(Kvdb_Key((*iter)->key_, (*iter)->keyLength_));
+    }
+
+    std::vector<Kvdb_Digest> digests(keys.size());
+    KeyDigestHandle::ComputeDigests(keys.data(), digests.data(), keys.size(),
+                                    digest_type);
+
+    int i = 0;
+    for (std::list<KVSlice *>::iterator iter = slices.begin();
+            iter != slices.end(); iter++) {
+        (*iter)->digestBuf_ = digests[i++];
+        (*iter)->digest_ = &(*iter)->digestBuf_;
     }
-    digest_ = new Kvdb_Digest();
+}
+
+void KVSlice::computeDigest(int digest_type) {
+    digest_ = &digestBuf_;
     Kvdb_Key vkey(key_, keyLength_);
-    KeyDigestHandle::ComputeDigest(&vkey, *digest_);
+    KeyDigestHandle::ComputeDigest(&vkey, *digest_, digest_type);
 }
 
 string KVSlice::GetKeyStr() const {
@@ -109,34 +139,45 @@ string KVSlice::GetDataStr() const {
 }
 
 void KVSlice::SetHashEntry(const HashEntry *hash_entry) {
-    entry_ = new HashEntry(*hash_entry);
+    entryBuf_ = *hash_entry;
+    entry_ = &entryBuf_;
 }
 
 void KVSlice::SetSegId(uint32_t seg_id) {
     segId_ = seg_id;
 }
 
+void KVSlice::SetSeqNum(uint64_t seq_num) {
+    seqNum_ = seq_num;
+}
+
 Request::Request() :
-    done_(false), stat_(ReqStat::INIT), slice_(NULL), segPtr_(NULL) {
+    done_(false), stat_(ReqStat::INIT), slice_(NULL), maxLatency_(0),
+            urgent_(false), segPtr_(NULL) {
 }
 
 Request::~Request() {
 }
 
 Request::Request(const Request& toBeCopied) :
-    done_(false), stat_(toBeCopied.stat_), slice_(toBeCopied.slice_),
-    segPtr_(toBeCopied.segPtr_) {
+    done_(false), done_cb_(toBeCopied.done_cb_), stat_(toBeCopied.stat_),
+    slice_(toBeCopied.slice_), maxLatency_(toBeCopied.maxLatency_),
+    urgent_(toBeCopied.urgent_), segPtr_(toBeCopied.segPtr_) {
 }
 
 Request& Request::operator=(const Request& toBeCopied) {
     done_ = toBeCopied.done_;
+    done_cb_ = toBeCopied.done_cb_;
     stat_ = toBeCopied.stat_;
     slice_ = toBeCopied.slice_;
+    maxLatency_ = toBeCopied.maxLatency_;
+    urgent_ = toBeCopied.urgent_;
     segPtr_ = toBeCopied.segPtr_;
     return *this;
 }
 Request::Request(KVSlice& slice) : 
-    done_(false), stat_(ReqStat::INIT), slice_(&slice), segPtr_(NULL) {
+    done_(false), stat_(ReqStat::INIT), slice_(&slice), maxLatency_(0),
+            urgent_(false), segPtr_(NULL) {
 }
 
 void Request::SetWriteStat(bool stat) {
@@ -152,6 +193,13 @@ void Request::Wait() {
 }
 
 void Request::Signal() {
+    if (done_cb_) {
+        //done may delete the request and done_cb_ with it
+        std::function<void(Request*)> done;
+        done.swap(done_cb_);
+        done(this);
+        return;
+    }
     std::unique_lock<std::mutex> l(mtx_);
     done_ = true;
     cv_.notify_one();
@@ -168,11 +216,27 @@ SegBase::~SegBase() {
     if (segOndisk_) {
         delete segOndisk_;
     }
+    ReleaseDataBuf();
+}
+
+void SegBase::ReleaseDataBuf() {
     if (dataBuf_) {
-        delete[] dataBuf_;
+        segMgr_->PutSegBuf(dataBuf_);
+        dataBuf_ = NULL;
     }
 }
 
+void SegBase::reset() {
+    ReleaseDataBuf();
+    segId_ = -1;
+    headPos_ = SegmentManager::SizeOfSegOnDisk();
+    tailPos_ = segSize_;
+    keyNum_ = 0;
+    keyAlignedNum_ = 0;
+    sliceList_.clear();
+    *segOndisk_ = SegmentOnDisk();
+}
+
 SegBase::SegBase(const SegBase& toBeCopied) {
     segOndisk_ = new SegmentOnDisk();
     copyHelper(toBeCopied);
@@ -212,28 +276,72 @@ bool SegBase::TryPut(KVSlice* slice) {
 #else
     uint32_t needSize = slice->GetDataLen() + IndexManager::SizeOfDataHeader();
 #endif
-    return freeSize > needSize;
+    if (freeSize <= needSize) {
+        return false;
+    }
+    //Put copies the record in, the buffer has to be there first
+    if (!dataBuf_ && !newDataBuffer()) {
+        __ERROR("Segment cann't alloc memory to put the record");
+        return false;
+    }
+    return true;
 }
 
 void SegBase::Put(KVSlice* slice) {
+    //the record goes to the buffer right away, the caller's key and data
+    //are not needed after Put
+    uint32_t head_pos = headPos_;
+    uint32_t data_offset;
     if (slice->IsAlignedData()) {
+        tailPos_ -= ALIGNED_SIZE;
+        data_offset = tailPos_;
 #ifdef WITH_ITERATOR
         headPos_ += IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
 #else
         headPos_ += IndexManager::SizeOfDataHeader();
 #endif
-        tailPos_ -= ALIGNED_SIZE;
         keyAlignedNum_++;
     } else {
 #ifdef WITH_ITERATOR
-        headPos_ += IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
+        data_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
+#else
+        data_offset = head_pos + IndexManager::SizeOfDataHeader();
+#endif
+        headPos_ = data_offset + slice->GetDataLen();
+    }
+
+#ifdef WITH_ITERATOR
+    DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
+                           data_offset, headPos_, slice->GetSeqNum());
 #else
-        headPos_ += IndexManager::SizeOfDataHeader() + slice->GetDataLen();
+    DataHeader data_header(slice->GetDigest(), slice->GetDataLen(),
+                           data_offset, headPos_, slice->GetSeqNum());
+#endif
+    //offset in segment until the segment id is known, see fillEntryToSlice
+    HashEntry hash_entry(data_header, head_pos);
+    slice->SetHashEntry(&hash_entry);
+
+    memcpy(&dataBuf_[head_pos], &data_header, IndexManager::SizeOfDataHeader());
+#ifdef WITH_ITERATOR
+    memcpy(&dataBuf_[head_pos + IndexManager::SizeOfDataHeader()],
+           slice->GetKey(), slice->GetKeyLen());
 #endif
+    if (slice->GetDataLen()) {
+        memcpy(&dataBuf_[data_offset], slice->GetData(), slice->GetDataLen());
     }
+
     keyNum_++;
     sliceList_.push_back(slice);
-    __DEBUG("Put request key = %s", slice->GetKeyStr().c_str());
+    __DEBUG("Put request key = %s, header_offset=%u, data_offset=%u, head_pos=%u, tail_pos = %u",
+            slice->GetKeyStr().c_str(), head_pos, data_offset, headPos_, tailPos_);
+}
+
+void SegBase::SetSeqNum(uint64_t seq_num) {
+    segOndisk_->SetSeqNum(seq_num);
+}
+
+uint64_t SegBase::GetSeqNum() const {
+    return segOndisk_->seq_num;
 }
 
 bool SegBase::WriteSegToDevice() {
@@ -248,87 +356,26 @@ bool SegBase::WriteSegToDevice() {
 }
 
 void SegBase::fillEntryToSlice() {
-    uint32_t head_pos = SegmentManager::SizeOfSegOnDisk();
-    uint32_t tail_pos = segSize_;
-    for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
+    uint64_t seg_offset = 0;
+    segMgr_->ComputeSegOffsetFromId(segId_, seg_offset);
+    for (vector<KVSlice *>::iterator iter = sliceList_.begin(); iter
             != sliceList_.end(); iter++) {
-
         KVSlice *slice = *iter;
         slice->SetSegId(segId_);
-        if (slice->IsAlignedData()) {
-            uint32_t data_offset = tail_pos - ALIGNED_SIZE;
-#ifdef WITH_ITERATOR
-            uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
-            DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
-                                   data_offset, next_offset);
-#else
-            uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader();
-            DataHeader data_header(slice->GetDigest(), slice->GetDataLen(),
-                                   data_offset, next_offset);
-#endif
-
-            uint64_t seg_offset = 0;
-            segMgr_->ComputeSegOffsetFromId(segId_, seg_offset);
-            uint64_t header_offset = seg_offset + head_pos;
-
-            HashEntry hash_entry(data_header, header_offset, NULL);
-            slice->SetHashEntry(&hash_entry);
-
-#ifdef WITH_ITERATOR
-            head_pos += IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
-#else
-            head_pos += IndexManager::SizeOfDataHeader();
-#endif
-            tail_pos -= ALIGNED_SIZE;
-            __DEBUG("SegmentSlice: key=%s, data_offset=%u, header_offset=%lu, seg_id=%u, head_pos=%u, tail_pos = %u", slice->GetKey(), data_offset, header_offset, segId_, head_pos, tail_pos);
-        } else {
-#ifdef WITH_ITERATOR
-            uint32_t data_offset = head_pos + IndexManager::SizeOfDataHeader() + slice->GetKeyLen();
-            uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader()
-                    + slice->GetKeyLen() + slice->GetDataLen();
-#else
-            uint32_t data_offset = head_pos + IndexManager::SizeOfDataHeader();
-            uint32_t next_offset = head_pos + IndexManager::SizeOfDataHeader()
-                    + slice->GetDataLen();
-
-#endif
-
-#ifdef WITH_ITERATOR
-            DataHeader data_header(slice->GetDigest(), slice->GetKeyLen(), slice->GetDataLen(),
-                                   data_offset, next_offset);
-#else
-            DataHeader data_header(slice->GetDigest(), slice->GetDataLen(),
-                                   data_offset, next_offset);
-#endif
-            uint64_t seg_offset = 0;
-            segMgr_->ComputeSegOffsetFromId(segId_, seg_offset);
-            uint64_t header_offset = seg_offset + head_pos;
-
-            HashEntry hash_entry(data_header, header_offset, NULL);
-            slice->SetHashEntry(&hash_entry);
-
-#ifdef WITH_ITERATOR
-            head_pos += IndexManager::SizeOfDataHeader() + slice->GetKeyLen() + slice->GetDataLen();
-#else
-            head_pos += IndexManager::SizeOfDataHeader() + slice->GetDataLen();
-#endif
-            __DEBUG("SegmentSlice: key=%s, data_offset=%u, header_offset=%lu, seg_id=%u, head_pos=%u, tail_pos = %u", slice->GetKey(), data_offset, header_offset, segId_, head_pos, tail_pos);
-
-        }
-    }
-    if (head_pos != headPos_ || tail_pos != tailPos_) {
-        __ERROR("Segment fillEntryToSlice  Failed!!! head_pos= %u, headPos_=%u, tail_pos= %u, tailPos_ = %u", head_pos, headPos_, tail_pos, tailPos_);
+        HashEntry &entry = slice->GetHashEntry();
+        entry = HashEntry(entry.GetEntryOnDisk().GetDataHeader(),
+                          seg_offset + entry.GetHeaderOffsetPhy());
     }
 }
 
 
 bool SegBase::_writeDataToDevice() {
-    if (!newDataBuffer()) {
+    if (!dataBuf_ && (keyNum_ || !newDataBuffer())) {
         __ERROR("Write Segment error cause by cann't alloc memory, seg_id:%u", segId_);
         return false;
     }
 
-    copyToDataBuf();
+    sealDataBuf();
     uint64_t offset = 0;
     segMgr_->ComputeSegOffsetFromId(segId_, offset);
 
@@ -340,67 +387,29 @@ bool SegBase::_writeDataToDevice() {
 }
 
 bool SegBase::newDataBuffer() {
-    //dataBuf_ = new char[segSize_];
-    posix_memalign((void **)&dataBuf_, 4096, segSize_);
-    return true;
+    dataBuf_ = segMgr_->GetSegBuf();
+    return dataBuf_ != NULL;
 }
 
-void SegBase::copyToDataBuf() {
-    uint64_t offset = 0;
-    segMgr_->ComputeSegOffsetFromId(segId_, offset);
-
-    uint32_t offset_begin = 0;
-    uint32_t offset_end = segSize_;
-
-    offset_begin += SegmentManager::SizeOfSegOnDisk();
-
-    //aggregate iovec
-    for (list<KVSlice *>::iterator iter = sliceList_.begin(); iter
-            != sliceList_.end(); iter++) {
-        KVSlice *slice = *iter;
-        DataHeader *header =
-                &slice->GetHashEntry().GetEntryOnDisk().GetDataHeader();
-        char *data = (char *) slice->GetData();
-        uint16_t data_len = slice->GetDataLen();
-
-#ifdef WITH_ITERATOR
-        char *key = (char *) slice->GetKey();
-        uint16_t key_len = slice->GetKeyLen();
-#else
-#endif
-        memcpy(&(dataBuf_[offset_begin]), header,
-               IndexManager::SizeOfDataHeader());
-        offset_begin += IndexManager::SizeOfDataHeader();
-#ifdef WITH_ITERATOR
-        memcpy(&(dataBuf_[offset_begin]), key, key_len);
-        offset_begin += key_len;
-#else
-#endif
-
-        if (slice->IsAlignedData()) {
-            offset_end -= data_len;
-            memcpy(&(dataBuf_[offset_end]), data, data_len);
-            __DEBUG("write key = %s, data position: %u", slice->GetKey(), offset_end);
-        } else {
-            memcpy(&(dataBuf_[offset_begin]), data, data_len);
-            __DEBUG("write key = %s, data position: %u", slice->GetKey(), offset_begin);
-            offset_begin += data_len;
-        }
-    }
-
-    //copy segment header to data buffer.
-    //segOndisk_->SetTS(persistTime_);
+void SegBase::sealDataBuf() {
+    //records are in place since Put, only the segment header and the free
+    //space in between are left
     segOndisk_->SetKeyNum(keyNum_);
-    //setOndisk_->SetCrc(crc_num);
+    segOndisk_->checksum = 0;
     memcpy(dataBuf_, segOndisk_, SegmentManager::SizeOfSegOnDisk());
 
     //set 0 to free data buffer
-    memset(&(dataBuf_[offset_begin]), 0, (offset_end - offset_begin));
+    memset(&(dataBuf_[headPos_]), 0, (tailPos_ - headPos_));
+
+    //recovery only trusts a segment whose checksum matches
+    segOndisk_->checksum = KVCrc::Crc32c(0, dataBuf_, segSize_);
+    memcpy(dataBuf_, segOndisk_, SegmentManager::SizeOfSegOnDisk());
 }
 
 SegForReq::SegForReq() :
-    SegBase(), idxMgr_(NULL), timeout_(0), startTime_(KVTime()), persistTime_(KVTime()),
-        isCompleted_(false), hasReq_(false), reqCommited_(0) {
+    SegBase(), idxMgr_(NULL), timeout_(0), startTime_(KVTime()),
+        isCompleted_(false), hasReq_(false), urgent_(false), firstSeq_(0),
+        reqCommited_(0) {
 }
 
 SegForReq::~SegForReq() {
@@ -418,9 +427,10 @@ SegForReq& SegForReq::operator=(const SegForReq& toBeCopied) {
     idxMgr_ = toBeCopied.idxMgr_;
     timeout_ = toBeCopied.timeout_;
     startTime_ = toBeCopied.startTime_;
-    persistTime_ = toBeCopied.persistTime_;
     isCompleted_ = toBeCopied.isCompleted_;
     hasReq_ = toBeCopied.hasReq_;
+    urgent_ = toBeCopied.urgent_;
+    firstSeq_ = toBeCopied.firstSeq_;
     reqCommited_.store(toBeCopied.reqCommited_.load());
     reqList_ = toBeCopied.reqList_;
     delReqList_ = toBeCopied.delReqList_;
@@ -428,8 +438,21 @@ SegForReq& SegForReq::operator=(const SegForReq& toBeCopied) {
 }
 
 SegForReq::SegForReq(SegmentManager* sm, IndexManager* im, BlockDevice* bdev, uint32_t timeout) :
-    SegBase(sm, bdev), idxMgr_(im), timeout_(timeout), startTime_(KVTime()), persistTime_(KVTime()),
-    isCompleted_(false), hasReq_(false), reqCommited_(0) {
+    SegBase(sm, bdev), idxMgr_(im), timeout_(timeout), startTime_(KVTime()),
+    isCompleted_(false), hasReq_(false), urgent_(false), firstSeq_(0),
+    reqCommited_(0) {
+}
+
+void SegForReq::Reset(uint32_t timeout) {
+    reset();
+    timeout_ = timeout;
+    isCompleted_ = false;
+    hasReq_ = false;
+    urgent_ = false;
+    firstSeq_ = 0;
+    reqCommited_.store(0);
+    reqList_.clear();
+    delReqList_.clear();
 }
 
 bool SegForReq::TryPut(Request* req) {
@@ -442,10 +465,22 @@ bool SegForReq::TryPut(Request* req) {
 
 void SegForReq::Put(Request* req) {
     KVSlice *slice = &req->GetSlice();
+    uint64_t seq_num = idxMgr_->NextSeqNum();
     if (GetKeyNum() == 0) {
         hasReq_ = true;
         startTime_.Update();
+        firstSeq_ = seq_num;
     }
+    if (req->GetMaxLatency()) {
+        //the segment waits no longer than its most pressing request
+        KVTime nowTime;
+        int64_t due = (nowTime - startTime_) + req->GetMaxLatency();
+        if (due < timeout_) {
+            timeout_ = due;
+        }
+    }
+    urgent_ = urgent_ || req->IsUrgent();
+    slice->SetSeqNum(seq_num);
     SegBase::Put(slice);
     reqList_.push_back(req);
     req->SetSeg(this);
@@ -462,45 +497,40 @@ void SegForReq::Complete() {
 void SegForReq::Notify(bool stat) {
     std::lock_guard < std::mutex > l(mtx_);
 
-    //Set logic timestamp to hashentry
     reqCommited_.store(GetKeyNum());
 
-    int32_t keyNo = 0;
-    persistTime_.Update();
-    for (list<Request *>::iterator iter = reqList_.begin(); iter
+    for (vector<Request *>::iterator iter = reqList_.begin(); iter
             != reqList_.end(); iter++) {
-        keyNo++;
         KVSlice *slice = &(*iter)->GetSlice();
         HashEntry &entry = slice->GetHashEntry();
-        entry.SetLogicStamp(persistTime_, keyNo);
 
         if (!slice->GetData()) {
             delReqList_.push_back(entry);
         }
     }
 
-    //notify and clean req.
-    while (!reqList_.empty()) {
-        Request *req = reqList_.front();
-        reqList_.pop_front();
-        req->SetWriteStat(stat);
-        req->Signal();
+    //notify and clean req, a request may be gone once signaled
+    for (vector<Request *>::iterator iter = reqList_.begin(); iter
+            != reqList_.end(); iter++) {
+        (*iter)->SetWriteStat(stat);
+        (*iter)->Signal();
     }
+    reqList_.clear();
 
 }
 
-bool SegForReq::IsExpired() {
-    KVTime nowTime;
+int64_t SegForReq::GetTimeLeft() {
     if (!hasReq_) {
-        return false;
+        return timeout_;
     }
+    KVTime nowTime;
     int64_t interval = nowTime - startTime_;
-    return (interval > timeout_);
+    return interval < timeout_ ? timeout_ - interval : 0;
 }
 
 void SegForReq::CleanDeletedEntry() {
     std::lock_guard < std::mutex > l(mtx_);
-    for (list<HashEntry>::iterator iter = delReqList_.begin(); iter
+    for (vector<HashEntry>::iterator iter = delReqList_.begin(); iter
             != delReqList_.end(); iter++) {
         idxMgr_->RemoveEntry(*iter);
     }
@@ -533,7 +563,7 @@ SegForSlice::SegForSlice(SegmentManager* sm, IndexManager* im, BlockDevice* bdev
 
 void SegForSlice::UpdateToIndex() {
     //std::lock_guard <std::mutex> l(mtx_);
-    list<KVSlice *> &slice_list = GetSliceList();
+    vector<KVSlice *> &slice_list = GetSliceList();
     idxMgr_->UpdateIndexes(slice_list);
     //for (list<KVSlice *>::iterator iter = slice_list.begin(); iter
     //        != slice_list.end(); iter++) {
@@ -1,10 +1,12 @@
 #include "SegmentManager.h"
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 
 namespace hlkvds {
 
 SegmentOnDisk::SegmentOnDisk() :
-    checksum(0), number_keys(0) {
+    checksum(0), number_keys(0), seq_num(0) {
     time_stamp = KVTime::GetNow();
 }
 
@@ -15,17 +17,19 @@ SegmentOnDisk::SegmentOnDisk(const SegmentOnDisk& toBeCopied) {
     time_stamp = toBeCopied.time_stamp;
     checksum = toBeCopied.checksum;
     number_keys = toBeCopied.number_keys;
+    seq_num = toBeCopied.seq_num;
 }
 
 SegmentOnDisk& SegmentOnDisk::operator=(const SegmentOnDisk& toBeCopied) {
     time_stamp = toBeCopied.time_stamp;
     checksum = toBeCopied.checksum;
     number_keys = toBeCopied.number_keys;
+    seq_num = toBeCopied.seq_num;
     return *this;
 }
 
 SegmentOnDisk::SegmentOnDisk(uint32_t num) :
-    checksum(0), number_keys(num) {
+    checksum(0), number_keys(num), seq_num(0) {
     time_stamp = KVTime::GetNow();
 }
 
@@ -80,6 +84,8 @@ bool SegmentManager::InitSegmentForCreateDB(uint64_t start_offset,
     for (uint32_t seg_index = 0; seg_index < segNum_; seg_index++) {
         segTable_.push_back(seg_stat);
     }
+    initDirtyPages();
+    initSegBufs();
 
     return true;
 }
@@ -121,35 +127,129 @@ bool SegmentManager::LoadSegmentTableFromDevice(uint64_t start_offset,
             usedCounter_++;
         } else if (segs_stat[seg_index].state == SegUseStat::RESERVED) {
             freedCounter_++;
+        } else if (segs_stat[seg_index].state == SegUseStat::INDEX) {
+            // Segments hold the relocated index, neither free nor used
+            seg_stat = segs_stat[seg_index];
         }
         segTable_.push_back(seg_stat);
     }
     delete[] segs_stat;
+    initDirtyPages();
+    initSegBufs();
     return true;
 }
 
-bool SegmentManager::WriteSegmentTableToDevice() {
-    SegmentStat* segs_stat = new SegmentStat[segNum_];
-    uint64_t length = sizeof(SegmentStat) * (uint64_t) segNum_;
-    for (uint32_t seg_index = 0; seg_index < segNum_; seg_index++) {
-        // If state is reserved, need reset segmentstat
-        if (segTable_[seg_index].state != SegUseStat::RESERVED) {
-            segs_stat[seg_index] = segTable_[seg_index];
-        } else {
-            __WARN("Segment Maybe not write to device! seg_id = %d", seg_index);
+bool SegmentManager::WriteSegmentTableToDevice(bool only_dirty) {
+    uint32_t page_size = getpagesize();
+    uint32_t page_num = dirtyPages_.size();
+
+    std::unique_lock < std::mutex > l(mtx_);
+    vector<uint32_t> pages;
+    for (uint32_t page = 0; page < page_num; page++) {
+        if (!only_dirty || dirtyPages_[page]) {
+            pages.push_back(page);
         }
     }
-    if (bdev_->pWrite(segs_stat, length, startOff_) != (ssize_t) length) {
-        __ERROR("can not write segment to device!");
-        delete[] segs_stat;
+    if (pages.empty()) {
+        sbMgr_->SetCurSegId(curSegId_);
+        return true;
+    }
+
+    char *align_buf;
+    uint64_t length = (uint64_t) page_size * pages.size();
+    if (posix_memalign((void **)&align_buf, 4096, length)) {
+        __ERROR("can not alloc buffer for segment table!");
         return false;
     }
-    delete[] segs_stat;
+    for (uint32_t i = 0; i < pages.size(); i++) {
+        fillTablePage(pages[i], &align_buf[(uint64_t) i * page_size]);
+    }
+    dirtyPages_.assign(page_num, false);
+    dirtyPageNum_ = 0;
+    uint32_t cur_seg_id = curSegId_;
+    l.unlock();
 
-    sbMgr_->SetCurSegId(curSegId_);
+    //write every run of adjacent pages at once
+    bool ret = true;
+    uint32_t first = 0;
+    for (uint32_t i = 1; i <= pages.size() && ret; i++) {
+        if (i < pages.size() && pages[i] == pages[i - 1] + 1) {
+            continue;
+        }
+        uint64_t run_length = (uint64_t) page_size * (i - first);
+        uint64_t offset = startOff_ + (uint64_t) page_size * pages[first];
+        if (bdev_->pWrite(&align_buf[(uint64_t) page_size * first], run_length,
+                          offset) != (ssize_t) run_length) {
+            __ERROR("can not write segment to device!");
+            ret = false;
+        }
+        first = i;
+    }
+    free(align_buf);
+
+    if (!ret) {
+        l.lock();
+        for (uint32_t i = 0; i < pages.size(); i++) {
+            if (!dirtyPages_[pages[i]]) {
+                dirtyPages_[pages[i]] = true;
+                dirtyPageNum_++;
+            }
+        }
+        return false;
+    }
+    __DEBUG("Write %lu pages of segment table to device", pages.size());
+
+    sbMgr_->SetCurSegId(cur_seg_id);
     return true;
 }
 
+uint32_t SegmentManager::GetDirtyPageNum() {
+    std::lock_guard < std::mutex > l(mtx_);
+    return dirtyPageNum_;
+}
+
+void SegmentManager::initDirtyPages() {
+    uint32_t page_size = getpagesize();
+    uint64_t length = sizeof(SegmentStat) * (uint64_t) segNum_;
+    dirtyPages_.assign((length + page_size - 1) / page_size, false);
+    dirtyPageNum_ = 0;
+}
+
+void SegmentManager::markDirty(uint32_t seg_id) {
+    uint32_t page_size = getpagesize();
+    uint64_t start = sizeof(SegmentStat) * (uint64_t) seg_id;
+    uint64_t end = start + sizeof(SegmentStat) - 1;
+    for (uint32_t page = start / page_size; page <= end / page_size; page++) {
+        if (!dirtyPages_[page]) {
+            dirtyPages_[page] = true;
+            dirtyPageNum_++;
+        }
+    }
+}
+
+void SegmentManager::fillTablePage(uint32_t page, char* buf) {
+    uint32_t page_size = getpagesize();
+    uint64_t stat_size = sizeof(SegmentStat);
+    uint64_t page_start = (uint64_t) page_size * page;
+    uint64_t page_end = page_start + page_size;
+    memset(buf, 0, page_size);
+
+    //a segment stat may straddle two pages
+    for (uint32_t seg_index = page_start / stat_size; seg_index < segNum_
+            && stat_size * seg_index < page_end; seg_index++) {
+        SegmentStat seg_stat;
+        // If state is reserved, need reset segmentstat
+        if (segTable_[seg_index].state != SegUseStat::RESERVED) {
+            seg_stat = segTable_[seg_index];
+        }
+        uint64_t stat_start = stat_size * seg_index;
+        uint64_t from = std::max(stat_start, page_start);
+        uint64_t to = std::min(stat_start + stat_size, page_end);
+        memcpy(&buf[from - page_start],
+               (const char *) &seg_stat + (from - stat_start), to - from);
+    }
+}
+
 bool SegmentManager::ComputeSegOffsetFromOffset(uint64_t offset,
                                                 uint64_t& seg_offset) {
     uint32_t seg_id = 0;
@@ -250,9 +350,11 @@ void SegmentManager::FreeForGC(uint32_t seg_id) {
     segTable_[seg_id].state = SegUseStat::FREE;
     segTable_[seg_id].free_size = 0;
     segTable_[seg_id].death_size = 0;
+    markDirty(seg_id);
 
     usedCounter_--;
     freedCounter_++;
+    gcFreedCounter_++;
     __DEBUG("Free Segment For GC, seg_id = %d", seg_id);
 }
 
@@ -260,12 +362,53 @@ void SegmentManager::Use(uint32_t seg_id, uint32_t free_size) {
     std::lock_guard < std::mutex > l(mtx_);
     segTable_[seg_id].state = SegUseStat::USED;
     segTable_[seg_id].free_size = free_size;
+    markDirty(seg_id);
 
     reservedCounter_--;
     usedCounter_++;
     __DEBUG("Used Segment seg_id = %d, free_size = %d", seg_id, free_size);
 }
 
+bool SegmentManager::AllocForIndex(uint32_t seg_num, uint32_t& first_seg_id) {
+    std::lock_guard < std::mutex > l(mtx_);
+    if (freedCounter_ < seg_num + SEG_RESERVED_FOR_GC) {
+        return false;
+    }
+
+    // The index is written sequentially, so look for a contiguous free run
+    uint32_t run = 0;
+    for (uint32_t seg_index = 0; seg_index < segNum_; seg_index++) {
+        if (segTable_[seg_index].state != SegUseStat::FREE) {
+            run = 0;
+            continue;
+        }
+        if (++run < seg_num) {
+            continue;
+        }
+        first_seg_id = seg_index + 1 - seg_num;
+        for (uint32_t i = first_seg_id; i <= seg_index; i++) {
+            segTable_[i].state = SegUseStat::INDEX;
+            markDirty(i);
+        }
+        freedCounter_ -= seg_num;
+        __DEBUG("Alloc %u Segments for index from seg_id = %d", seg_num, first_seg_id);
+        return true;
+    }
+    return false;
+}
+
+void SegmentManager::FreeForIndex(uint32_t first_seg_id, uint32_t seg_num) {
+    std::lock_guard < std::mutex > l(mtx_);
+    for (uint32_t i = first_seg_id; i < first_seg_id + seg_num; i++) {
+        segTable_[i].state = SegUseStat::FREE;
+        segTable_[i].free_size = 0;
+        segTable_[i].death_size = 0;
+        markDirty(i);
+    }
+    freedCounter_ += seg_num;
+    __DEBUG("Free %u Segments of index from seg_id = %d", seg_num, first_seg_id);
+}
+
 //void SegmentManager::Reserved(uint32_t seg_id)
 //{
 //    std::lock_guard<std::mutex> l(mtx_);
@@ -285,6 +428,65 @@ void SegmentManager::ModifyDeathEntry(HashEntry &entry) {
 
     std::lock_guard < std::mutex > l(mtx_);
     segTable_[seg_id].death_size += death_size;
+    markDirty(seg_id);
+}
+
+void SegmentManager::UseForRecovery(uint32_t seg_id, uint32_t free_size) {
+    std::lock_guard < std::mutex > l(mtx_);
+    if (segTable_[seg_id].state == SegUseStat::FREE) {
+        freedCounter_--;
+        usedCounter_++;
+    }
+    segTable_[seg_id].state = SegUseStat::USED;
+    segTable_[seg_id].free_size = free_size;
+    segTable_[seg_id].death_size = 0;
+    markDirty(seg_id);
+    __DEBUG("Recovered Segment seg_id = %d, free_size = %d", seg_id, free_size);
+}
+
+void SegmentManager::FreeForRecovery(uint32_t seg_id) {
+    std::lock_guard < std::mutex > l(mtx_);
+    if (segTable_[seg_id].state == SegUseStat::USED) {
+        usedCounter_--;
+        freedCounter_++;
+    }
+    segTable_[seg_id].state = SegUseStat::FREE;
+    segTable_[seg_id].free_size = 0;
+    segTable_[seg_id].death_size = 0;
+    markDirty(seg_id);
+    __DEBUG("Free torn Segment seg_id = %d", seg_id);
+}
+
+bool SegmentManager::IsIndexSeg(uint32_t seg_id) {
+    std::lock_guard < std::mutex > l(mtx_);
+    return segTable_[seg_id].state == SegUseStat::INDEX;
+}
+
+void SegmentManager::SetIndexSegs(uint32_t first_seg_id, uint32_t seg_num) {
+    std::lock_guard < std::mutex > l(mtx_);
+    for (uint32_t seg_index = 0; seg_index < segNum_; seg_index++) {
+        bool is_index = seg_index >= first_seg_id
+                && seg_index < first_seg_id + seg_num;
+        SegUseStat state = segTable_[seg_index].state;
+        if (is_index == (state == SegUseStat::INDEX)) {
+            continue;
+        }
+        if (is_index) {
+            if (state == SegUseStat::FREE) {
+                freedCounter_--;
+            } else if (state == SegUseStat::USED) {
+                usedCounter_--;
+            }
+            segTable_[seg_index].state = SegUseStat::INDEX;
+        } else {
+            freedCounter_++;
+            segTable_[seg_index].state = SegUseStat::FREE;
+            __DEBUG("Free Segment left by index relocation, seg_id = %d", seg_index);
+        }
+        segTable_[seg_index].free_size = 0;
+        segTable_[seg_index].death_size = 0;
+        markDirty(seg_index);
+    }
 }
 
 uint32_t SegmentManager::GetTotalFreeSegs() {
@@ -292,6 +494,11 @@ uint32_t SegmentManager::GetTotalFreeSegs() {
     return freedCounter_;
 }
 
+uint64_t SegmentManager::GetGCFreedSegs() {
+    std::lock_guard < std::mutex > l(mtx_);
+    return gcFreedCounter_;
+}
+
 uint32_t SegmentManager::GetTotalUsedSegs() {
     std::lock_guard < std::mutex > l(mtx_);
     return usedCounter_;
@@ -316,15 +523,58 @@ void SegmentManager::SortSegsByUtils(
     } __DEBUG("There is tatal %lu segments utils under %f", cand_map.size(), utils);
 }
 
+void SegmentManager::initSegBufs() {
+    if (bufSlab_) {
+        return;
+    }
+    bufNum_ = std::max(options_.req_merge_thread, 1)
+            + std::max(options_.seg_write_thread, 0) + SEG_RESERVED_FOR_GC;
+    bufSlab_ = (char *) KVHugeMem::Alloc((size_t) bufNum_ * segSize_);
+    if (!bufSlab_) {
+        __WARN("Could not preallocate %u segment buffers, allocate them one by one",
+               bufNum_);
+        bufNum_ = 0;
+        return;
+    }
+    memset(bufSlab_, 0, (size_t) bufNum_ * segSize_);
+    for (uint32_t i = 0; i < bufNum_; i++) {
+        freeBufs_.push_back(bufSlab_ + (size_t) i * segSize_);
+    }
+}
+
+char* SegmentManager::GetSegBuf() {
+    {
+        std::lock_guard<std::mutex> l(bufMtx_);
+        if (!freeBufs_.empty()) {
+            char *buf = freeBufs_.back();
+            freeBufs_.pop_back();
+            return buf;
+        }
+    }
+    return (char *) KVHugeMem::Alloc(segSize_);
+}
+
+void SegmentManager::PutSegBuf(char* buf) {
+    if (buf >= bufSlab_ && buf < bufSlab_ + (size_t) bufNum_ * segSize_) {
+        std::lock_guard<std::mutex> l(bufMtx_);
+        freeBufs_.push_back(buf);
+        return;
+    }
+    KVHugeMem::Free(buf, segSize_);
+}
+
 SegmentManager::SegmentManager(BlockDevice* bdev, SuperBlockManager* sbm,
                                Options &opt) :
-    dataStartOff_(0), dataEndOff_(0), segSize_(0), segSizeBit_(0), segNum_(0),
+    dirtyPageNum_(0), dataStartOff_(0), dataEndOff_(0), segSize_(0), segSizeBit_(0), segNum_(0),
             curSegId_(0), usedCounter_(0), freedCounter_(0),
-            reservedCounter_(0), maxValueLen_(0), bdev_(bdev), sbMgr_(sbm),
-            options_(opt) {
+            reservedCounter_(0), gcFreedCounter_(0), maxValueLen_(0), bdev_(bdev), sbMgr_(sbm),
+            options_(opt), bufSlab_(NULL), bufNum_(0) {
 }
 
 SegmentManager::~SegmentManager() {
     segTable_.clear();
+    if (bufSlab_) {
+        KVHugeMem::Free(bufSlab_, (size_t) bufNum_ * segSize_);
+    }
 }
 } //end namespace hlkvds
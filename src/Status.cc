@@ -9,12 +9,31 @@
 namespace hlkvds {
 
 Status::Status(Code _code, const char* msg) :
-    code_(_code) {
-    uint32_t size = strlen(msg);
+    code_(_code), state_(copyState(msg)) {
+}
+
+Status::Status(const Status& s) :
+    code_(s.code_), state_(copyState(s.state_)) {
+}
+
+Status& Status::operator=(const Status& s) {
+    if (this != &s) {
+        delete[] state_;
+        code_ = s.code_;
+        state_ = copyState(s.state_);
+    }
+    return *this;
+}
+
+const char* Status::copyState(const char* state) {
+    if (!state) {
+        return nullptr;
+    }
+    uint32_t size = strlen(state);
     char* const result = new char[size + 1];
-    memcpy(result, msg, size);
+    memcpy(result, state, size);
     result[size] = '\0';
-    state_ = result;
+    return result;
 }
 
 std::string Status::ToString() const {
@@ -19,38 +19,72 @@ bool SuperBlockManager::LoadSuperBlockFromDevice(uint64_t offset) {
     startOff_ = offset;
 
     uint64_t length = SuperBlockManager::SizeOfDBSuperBlock();
-    if ((uint64_t) bdev_->pRead(sb_, length, offset) != length) {
-        __ERROR("Could not read superblock from device\n");
+    bool found = false;
+    for (int i = 0; i < 2; i++) {
+        DBSuperBlock sb;
+        uint64_t copy_offset = offset + i * sizeOfCopyOnDevice();
+        if ((uint64_t) bdev_->pRead(&sb, length, copy_offset) != length) {
+            __ERROR("Could not read superblock from device\n");
+            return false;
+        }
+        //a copy torn by a crash is skipped, the other one is committed
+        if (!isValidCopy(sb)) {
+            __WARN("Superblock copy %d is not valid", i);
+            continue;
+        }
+        if (!found || sb.checkpoint_gen > sb_->checkpoint_gen) {
+            memcpy((void *)sb_, (const void *)&sb, length);
+            found = true;
+        }
+    }
+    if (!found) {
+        __ERROR("Could not find a valid superblock on device\n");
         return false;
     }
+    __DEBUG("Load superblock of checkpoint generation %lu", sb_->checkpoint_gen);
 
     return true;
 }
 
 bool SuperBlockManager::WriteSuperBlockToDevice() {
-    uint64_t length = SuperBlockManager::GetSuperBlockSizeOnDevice();
+    uint64_t length = sizeOfCopyOnDevice();
     char *align_buf;
     posix_memalign((void **)&align_buf, 4096, length);
     memset(align_buf, 0, length);
-    memcpy((void *)align_buf, (const void*)sb_, SuperBlockManager::SizeOfDBSuperBlock());
-    if ((uint64_t) bdev_->pWrite(align_buf, length, startOff_) != length) {
-        __ERROR("Could not write superblock at position %ld\n", startOff_);
+
+    std::unique_lock < std::mutex > l(mtx_);
+    DBSuperBlock *sb = (DBSuperBlock *) align_buf;
+    memcpy((void *)sb, (const void*)sb_, SuperBlockManager::SizeOfDBSuperBlock());
+    l.unlock();
+
+    sb->checkpoint_gen++;
+    sb->checksum = 0;
+    sb->checksum = KVCrc::Crc32c(0, sb, SuperBlockManager::SizeOfDBSuperBlock());
+
+    uint64_t offset = startOff_ + (sb->checkpoint_gen % 2) * length;
+    if ((uint64_t) bdev_->pWrite(align_buf, length, offset) != length) {
+        __ERROR("Could not write superblock at position %ld\n", offset);
         free(align_buf);
         return false;
     }
+
+    l.lock();
+    sb_->checkpoint_gen = sb->checkpoint_gen;
+    l.unlock();
     free(align_buf);
     return true;
+}
 
-    //uint64_t length = SuperBlockManager::SizeOfDBSuperBlock();
-    //if ((uint64_t) bdev_->pWrite(sb_, length, startOff_) != length) {
-    //    __ERROR("Could not write superblock at position %ld\n", startOff_);
-    //    return false;
-    //}
-    //return true;
+bool SuperBlockManager::isValidCopy(const DBSuperBlock& sb) {
+    DBSuperBlock copy = sb;
+    copy.checksum = 0;
+    return sb.checkpoint_gen != 0 && sb.checksum
+            == KVCrc::Crc32c(0, &copy, SuperBlockManager::SizeOfDBSuperBlock());
 }
 
 void SuperBlockManager::SetSuperBlock(DBSuperBlock& sb) {
     std::lock_guard < std::mutex > l(mtx_);
+    sb_->magic_number = sb.magic_number;
     sb_->hashtable_size = sb.hashtable_size;
     sb_->number_elements = sb.number_elements;
     sb_->segment_size = sb.segment_size;
@@ -62,9 +96,17 @@ void SuperBlockManager::SetSuperBlock(DBSuperBlock& sb) {
     sb_->db_data_region_size = sb.db_data_region_size;
     sb_->device_capacity = sb.device_capacity;
     sb_->data_theory_size = sb.data_theory_size;
+    sb_->index_offset = sb.index_offset;
+    sb_->index_seg_num = sb.index_seg_num;
+    sb_->digest_type = sb.digest_type;
+    sb_->index_mode = sb.index_mode;
 }
 
 uint64_t SuperBlockManager::GetSuperBlockSizeOnDevice() {
+    return 2 * sizeOfCopyOnDevice();
+}
+
+uint64_t SuperBlockManager::sizeOfCopyOnDevice() {
     uint64_t sb_size_pages = SuperBlockManager::SizeOfDBSuperBlock()
             / getpagesize();
     return (sb_size_pages + 1) * getpagesize();
@@ -78,6 +120,17 @@ SuperBlockManager::~SuperBlockManager() {
     delete sb_;
 }
 
+void SuperBlockManager::SetHTSize(uint32_t size) {
+    std::lock_guard < std::mutex > l(mtx_);
+    sb_->hashtable_size = size;
+}
+
+void SuperBlockManager::SetIndexLocation(uint64_t offset, uint32_t seg_num) {
+    std::lock_guard < std::mutex > l(mtx_);
+    sb_->index_offset = offset;
+    sb_->index_seg_num = seg_num;
+}
+
 void SuperBlockManager::SetElementNum(uint32_t num) {
     std::lock_guard < std::mutex > l(mtx_);
     sb_->number_elements = num;
@@ -92,4 +145,16 @@ void SuperBlockManager::SetDataTheorySize(uint64_t size) {
     std::lock_guard < std::mutex > l(mtx_);
     sb_->data_theory_size = size;
 }
+
+void SuperBlockManager::SetCleanShutdown(bool clean) {
+    std::lock_guard < std::mutex > l(mtx_);
+    sb_->clean_shutdown = clean ? 1 : 0;
+}
+
+void SuperBlockManager::SetCheckpointSeqNum(uint64_t checkpoint_seq,
+                                            uint64_t next_seq) {
+    std::lock_guard < std::mutex > l(mtx_);
+    sb_->checkpoint_seq = checkpoint_seq;
+    sb_->next_seq = next_seq;
+}
 } // namespace hlkvds
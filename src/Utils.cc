@@ -1,4 +1,20 @@
 #include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <mutex>
+#include <map>
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 #include "Utils.h"
 
 namespace hlkvds {
@@ -83,6 +99,267 @@ int64_t KVTime::operator-(const KVTime& toBeCopied) {
 KVTime::~KVTime() {
 }
 
+static const uint32_t CRC32C_POLY = 0x82f63b78;
+
+struct Crc32cTable {
+    uint32_t t[256];
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            t[i] = c;
+        }
+    }
+};
+
+static uint32_t crc32cSoft(uint32_t crc, const unsigned char* p, size_t len) {
+    static const Crc32cTable table;
+    while (len--) {
+        crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHw(uint32_t crc, const unsigned char* p, size_t len) {
+    uint64_t c = crc;
+    while (len >= sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += sizeof(v);
+        len -= sizeof(v);
+    }
+    uint32_t c32 = (uint32_t) c;
+    while (len--) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return c32;
+}
+#endif
+
+int KVNuma::NodeNum() {
+    static int node_num = 0;
+    if (node_num) {
+        return node_num;
+    }
+    int num = 0;
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir) {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            int node;
+            if (sscanf(ent->d_name, "node%d", &node) == 1) {
+                num++;
+            }
+        }
+        closedir(dir);
+    }
+    node_num = num ? num : 1;
+    return node_num;
+}
+
+bool KVNuma::BindMemory(void* addr, size_t len, int node) {
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask,
+                   sizeof(mask) * 8, 0) == 0;
+}
+
+bool KVNuma::BindThread(int node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    //cpulist is like "0-7,16-23"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    int first, last;
+    char sep;
+    while (fscanf(fp, "%d", &first) == 1) {
+        last = first;
+        if (fscanf(fp, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(fp, "%d", &last) != 1) {
+                break;
+            }
+            fscanf(fp, "%c", &sep);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    fclose(fp);
+    return CPU_COUNT(&cpus) && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+namespace {
+enum HugeKind {
+    HUGE_TLBFS,
+    HUGE_ADVISED,
+    HUGE_NONE
+};
+
+struct HugeRegion {
+    size_t mapLen;
+    HugeKind kind;
+};
+
+std::mutex hugeMtx;
+std::map<void*, HugeRegion> hugeRegions;
+uint64_t hugeBytes[HUGE_NONE];
+
+size_t roundUp(size_t len, size_t unit) {
+    return (len + unit - 1) / unit * unit;
+}
+
+void* mapHugetlb(size_t map_len, int flags) {
+    void *ptr = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | flags, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+//Plain pages aligned to HUGE_PAGE_SIZE, so the kernel can back them
+//by transparent huge pages
+void* mapAligned(size_t map_len) {
+    size_t raw_len = map_len + HUGE_PAGE_SIZE;
+    void *raw = mmap(NULL, raw_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    char *ptr = (char *) roundUp((size_t) raw, HUGE_PAGE_SIZE);
+    size_t head = ptr - (char *) raw;
+    if (head) {
+        munmap(raw, head);
+    }
+    munmap(ptr + map_len, raw_len - head - map_len);
+    return ptr;
+}
+}
+
+void* KVHugeMem::Alloc(size_t len, size_t align) {
+    if (len < HUGE_PAGE_SIZE) {
+        void *ptr = NULL;
+        return posix_memalign(&ptr, align, len) ? NULL : ptr;
+    }
+
+    HugeRegion region;
+    void *ptr = NULL;
+    region.kind = HUGE_TLBFS;
+    if (len >= HUGE_PAGE_SIZE_1G) {
+        region.mapLen = roundUp(len, HUGE_PAGE_SIZE_1G);
+        ptr = mapHugetlb(region.mapLen, MAP_HUGE_1GB);
+    }
+    if (!ptr) {
+        region.mapLen = roundUp(len, HUGE_PAGE_SIZE);
+        ptr = mapHugetlb(region.mapLen, 0);
+    }
+    if (!ptr) {
+        ptr = mapAligned(region.mapLen);
+        if (!ptr) {
+            return NULL;
+        }
+        region.kind = madvise(ptr, region.mapLen, MADV_HUGEPAGE) ?
+                HUGE_NONE : HUGE_ADVISED;
+    }
+
+    std::lock_guard<std::mutex> l(hugeMtx);
+    hugeRegions[ptr] = region;
+    if (region.kind != HUGE_NONE) {
+        hugeBytes[region.kind] += region.mapLen;
+    }
+    return ptr;
+}
+
+void KVHugeMem::Free(void* ptr, size_t len) {
+    if (!ptr) {
+        return;
+    }
+    if (len < HUGE_PAGE_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    HugeRegion region;
+    {
+        std::lock_guard<std::mutex> l(hugeMtx);
+        std::map<void*, HugeRegion>::iterator iter = hugeRegions.find(ptr);
+        if (iter == hugeRegions.end()) {
+            return;
+        }
+        region = iter->second;
+        hugeRegions.erase(iter);
+        if (region.kind != HUGE_NONE) {
+            hugeBytes[region.kind] -= region.mapLen;
+        }
+    }
+    munmap(ptr, region.mapLen);
+}
+
+uint64_t KVHugeMem::HugetlbBytes() {
+    std::lock_guard<std::mutex> l(hugeMtx);
+    return hugeBytes[HUGE_TLBFS];
+}
+
+uint64_t KVHugeMem::AdvisedBytes() {
+    std::lock_guard<std::mutex> l(hugeMtx);
+    return hugeBytes[HUGE_ADVISED];
+}
+
+uint64_t KVHugeMem::ThpBackedBytes() {
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    if (!fp) {
+        return 0;
+    }
+    char line[256];
+    uint64_t kb = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return kb * 1024;
+}
+
+uint32_t KVCrc::Crc32c(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*) data;
+    crc = ~crc;
+#if defined(__x86_64__)
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) {
+        return ~crc32cHw(crc, p, len);
+    }
+#endif
+    return ~crc32cSoft(crc, p, len);
+}
+
+int KVVarint::Encode(uint64_t value, char* buf) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (char) value;
+    return n;
+}
+
+int KVVarint::Decode(const char* buf, size_t len, uint64_t& value) {
+    value = 0;
+    for (int n = 0; n < MaxSize && (size_t) n < len; n++) {
+        uint64_t byte = (unsigned char) buf[n];
+        value |= (byte & 0x7f) << (7 * n);
+        if (!(byte & 0x80)) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
 void* Thread::runThread(void* arg) {
     return ((Thread*) arg)->Entry();
 }
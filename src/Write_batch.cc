@@ -11,12 +11,14 @@ WriteBatch::~WriteBatch() {
 
 void WriteBatch::put(const char *key, uint32_t key_len, const char* data,
                     uint16_t length) {
-    KVSlice *slice = new KVSlice(key, key_len, data, length, true);
+    KVSlice *slice = new KVSlice(key, key_len, data, length, true,
+                                 KVSlice::NO_DIGEST);
     batch_.push_back(slice);
 }
 
 void WriteBatch::del(const char *key, uint32_t key_len) {
-    KVSlice *slice = new KVSlice(key, key_len, NULL, 0);
+    KVSlice *slice = new KVSlice(key, key_len, NULL, 0, false,
+                                 KVSlice::NO_DIGEST);
     batch_.push_back(slice);
 }
 void WriteBatch::clear() {
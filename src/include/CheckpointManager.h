@@ -0,0 +1,46 @@
+#ifndef _HLKVDS_CHECKPOINTMANAGER_H_
+#define _HLKVDS_CHECKPOINTMANAGER_H_
+
+#include <sys/types.h>
+#include <mutex>
+
+#include "Db_Structure.h"
+#include "hlkvds/Options.h"
+#include "SuperBlockManager.h"
+#include "IndexManager.h"
+#include "SegmentManager.h"
+
+namespace hlkvds {
+
+// A checkpoint writes the index ranges and segment table pages changed
+// since the last one, then commits them by writing the next superblock
+// generation. Index ranges go to the block not committed yet, so a crash
+// in between leaves the former checkpoint intact. Recovery replays the
+// segments written since the sequence number the checkpoint saved.
+class CheckpointManager {
+public:
+    CheckpointManager(SuperBlockManager* sbm, IndexManager* im,
+                      SegmentManager* sm, Options &opt);
+    ~CheckpointManager();
+
+    //A full checkpoint writes all index ranges and the whole segment table
+    bool Checkpoint(bool full);
+    //Called by the background thread, skips if nothing changed
+    void BackCheckpoint();
+
+private:
+    CheckpointManager(const CheckpointManager&);
+    CheckpointManager& operator=(const CheckpointManager&);
+
+private:
+    SuperBlockManager* sbMgr_;
+    IndexManager* idxMgr_;
+    SegmentManager* segMgr_;
+    Options &options_;
+
+    std::mutex ckptMtx_;
+};
+
+}//namespace hlkvds
+
+#endif //#ifndef _HLKVDS_CHECKPOINTMANAGER_H_
@@ -2,15 +2,41 @@
 #define _HLKVDS_DB_STRUCTURE_H_
 
 #include <stdint.h>
+#include <pthread.h>
 
 namespace hlkvds {
-#define MAGIC_NUMBER 0xffff0001
+#define MAGIC_NUMBER 0xffff0006
 
 #define WITH_ITERATOR 1
 
 #define RMDsize 160
 #define KEYDIGEST_INT_NUM RMDsize/(sizeof(uint32_t)*8) // RIPEMD-160/(sizeof(uint32_t)*8) 160/32
+#define RMD_MB_MIN_KEYS 4 // smaller batches are digested one key at a time
 #define SEG_RESERVED_FOR_GC 2
+#define SEG_REAP_RETRY_MSEC 10 // reaper retries segments whose deletes must wait this often
+#define BUCKET_ENTRY_NUM 8 // entries in one index hash bucket, tags fill 16 bytes
+#define BUCKET_MIGRATE_STEP 4 // old buckets moved per index update while resizing
+#define BUCKET_MAX_NUM (1U << 28)
+#define OPTIMISTIC_READ_RETRY 8 // lock-free index reads tried before taking the lock
+#define EPOCH_READER_SLOT_NUM 64 // reader counters of the epoch manager
+#define EPOCH_RECLAIM_BATCH 256 // retired objects kept before reclaiming them
+#define RECOVERY_THREAD_NUM 8 // threads scanning segments after an unclean shutdown
+#define INDEX_BLOCK_SIZE 4096 // one range of index slots on device, kept in 2 copies
+#define INDEX_RANGE_SLOT_NUM 80 // index slots checkpointed together in one block
+#define INDEX_BLOCK_FORMAT 1 // encoding of the entries in an index block
+#define INDEX_BLOCK_FORMAT_LEAN 2 // encoding of the entries in the lean index mode
+#define INDEX_LOAD_RANGE_NUM 64 // index ranges read at once when loading
+#define INDEX_LOAD_THREAD_NUM 8 // threads loading index ranges on open
+#define INDEX_META_STRIPE_NUM 64 // stripes of the index counters and dirty marks
+#define INDEX_META_FOLD_NUM 32 // counter changes a stripe keeps before folding them
+#define WORK_QUEUE_CAPACITY 4096 // items a work queue holds before enqueue blocks
+#define WORK_QUEUE_SPIN_NUM 64 // empty polls of a work queue before its consumer sleeps
+#define WORK_QUEUE_WAIT_MSEC 10 // sleep of a producer on a full work queue before polling again
+#define REQ_MERGE_BATCH 64 // requests a merge thread takes from its queue at once
+#define GROUP_COMMIT_GAP_FACTOR 2 // arrival gaps a drained merge thread waits for more requests
+#define GROUP_COMMIT_EWMA_WEIGHT 8 // a new arrival gap counts 1/8 in the average
+#define HUGE_PAGE_SIZE (2UL << 20) // buffers of at least this size go on huge pages
+#define HUGE_PAGE_SIZE_1G (1UL << 30) // and of at least this size try 1GB pages first
 
 //default Options
 #define SEGMENT_SIZE 256 * 1024
@@ -18,10 +44,16 @@ namespace hlkvds {
 #define ALIGNED_SIZE 4096
 
 #define SEG_WRITE_THREAD 10
+#define READ_THREAD 4 // threads serving asynchronous gets
+#define REQ_MERGE_THREAD 4 // open segments, each filled by its own merge thread
 #define SEG_FULL_RATE 0.9
 #define CAPACITY_THRESHOLD_TODO_GC 0.5
 #define GC_UPPER_LEVEL 0.3
 #define GC_LOWER_LEVEL 0.1
+#define CHECKPOINT_INTERVAL 30 // unit seconds
+#define INDEX_LOCK_NUM (1U << 16) // key locks of the index, shared by its buckets
+#define INDEX_CACHE_PAGES 1024 // index pages cached in the paged index mode
+#define INDEX_NUMA_CHUNK 64 // buckets placed on one NUMA node in a row
 
 //#define DEBUG
 #define INFO
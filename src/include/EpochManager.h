@@ -0,0 +1,61 @@
+#ifndef _HLKVDS_EPOCHMANAGER_H_
+#define _HLKVDS_EPOCHMANAGER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Db_Structure.h"
+
+using namespace std;
+
+namespace hlkvds {
+
+// Readers that don't take a lock announce themselves in a read section.
+// Memory unlinked by writers is retired instead of freed, and is only freed
+// once every read section that could have seen it has ended. Readers count
+// themselves in one of two counters chosen by the epoch parity, a reclaim
+// flips the epoch twice and waits for each counter to drain.
+class EpochManager {
+public:
+    EpochManager();
+    ~EpochManager();
+
+    //return the token to pass to ExitRead
+    int EnterRead();
+    void ExitRead(int token);
+
+    void Retire(void* ptr, void (*deleter)(void*));
+    //Free retired memory once there is a batch of it, or always if force.
+    //Never call it in a read section or holding a lock readers wait for
+    void Reclaim(bool force);
+
+private:
+    //padded so that two slots never share a cache line
+    struct ReaderSlot {
+        std::atomic<uint32_t> active[2];
+        char pad[64 - 2 * sizeof(std::atomic<uint32_t>)];
+    };
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+    };
+
+    EpochManager(const EpochManager&);
+    EpochManager& operator=(const EpochManager&);
+
+    void synchronize();
+
+    std::atomic<uint32_t> epoch_;
+    ReaderSlot slots_[EPOCH_READER_SLOT_NUM];
+
+    vector<Retired> retired_;
+    std::atomic<uint32_t> retiredNum_;
+    std::mutex retireMtx_;
+    std::mutex reclaimMtx_;
+};
+
+}// namespace hlkvds
+#endif //#ifndef _HLKVDS_EPOCHMANAGER_H_
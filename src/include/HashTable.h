@@ -0,0 +1,247 @@
+#ifndef _HLKVDS_HASHTABLE_H_
+#define _HLKVDS_HASHTABLE_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+#include "Db_Structure.h"
+#include "KeyDigestHandle.h"
+#include "IndexManager.h"
+#include "EpochManager.h"
+
+using namespace std;
+
+namespace hlkvds {
+
+// A bucket keeps BUCKET_ENTRY_NUM 16-bit digest tags in its first cache line,
+// followed by the slots themselves. A lookup compares all tags at once and
+// only touches the slots whose tag matches. Keys hashed to a full bucket are
+// placed in an overflow bucket chained from it. A slot is a HashEntry, or a
+// LeanEntry in the lean index mode; the table tells which slot it wants by a
+// match function.
+//
+// Writers hold the bucket lock and bump the sequence number of the head
+// bucket around every change to the chain, so an odd number means a change
+// is in progress. Readers don't lock, they redo the lookup if the sequence
+// number moved under them. Slots are plain values, so a removed slot is
+// only untagged. Overflow buckets a reader may still hold are retired to the
+// epoch manager.
+template <class Slot>
+class HashBucket {
+public:
+    enum ReadResult {
+        READ_MISS,
+        READ_HIT,
+        READ_RETRY,
+        READ_MOVED
+    };
+
+    HashBucket();
+    ~HashBucket();
+
+    //The slot with tag which match accepts, NULL if there is none
+    template <class Match>
+    Slot* Get(uint16_t tag, Match match);
+    //Overwrite the slot match accepts or take a free one,
+    //return true if the slot is new in this bucket chain
+    template <class Match>
+    bool Put(uint16_t tag, const Slot& slot, Match match);
+    template <class Match>
+    bool Remove(uint16_t tag, Match match, EpochManager& epoch);
+    void GetSlots(vector<Slot>& slots, vector<uint16_t>& tags);
+    void Clear();
+    //Empty the chain and mark it moved, readers are sent to the new table
+    void RetireAll(EpochManager& epoch);
+
+    //Lock-free lookup, must be in a read section of the epoch manager.
+    //found gets a copy of the slots match accepts until it returns true,
+    //the copies only count with READ_HIT
+    template <class Match, class Found>
+    ReadResult Read(uint16_t tag, Match match, Found found);
+
+    bool IsMoved() const {
+        return moved_.load(std::memory_order_relaxed);
+    }
+
+    //Buckets in chunks of INDEX_NUMA_CHUNK, chunk i placed on node i % nodes
+    static HashBucket* NewBuckets(uint32_t num, uint32_t nodes = 1);
+    static void DeleteBuckets(HashBucket* buckets, uint32_t num);
+
+private:
+    HashBucket(const HashBucket&);
+    HashBucket& operator=(const HashBucket&);
+
+    uint32_t matchTag(uint16_t tag) const;
+    bool isEmpty() const;
+
+    void writeBegin();
+    void writeEnd();
+    bool readValidate(uint32_t seq) const;
+    static void deleteBucket(void* ptr);
+
+    uint16_t tags_[BUCKET_ENTRY_NUM];
+    std::atomic<HashBucket*> next_;
+    std::atomic<uint32_t> seq_;
+    //set on a bucket of the old table once its slots are moved out
+    std::atomic<bool> moved_;
+    Slot entries_[BUCKET_ENTRY_NUM] __attribute__((aligned(8)));
+
+}__attribute__((aligned(64)));
+
+// What the index manager does with a table whatever its slots are.
+class IndexTable {
+public:
+    virtual ~IndexTable() {
+    }
+
+    virtual uint32_t GetBucketNum() const = 0;
+    virtual std::mutex& GetLock(const Kvdb_Digest& digest) = 0;
+    //Entries of bucket no in the current table, takes the lock itself
+    virtual void GetEntries(uint32_t no, vector<HashEntry>& entries) = 0;
+
+    //Start a resize if key_num is out of the load range of the table
+    virtual void CheckResize(uint32_t key_num) = 0;
+    //Move a few buckets of a resize in progress and free the retired
+    //memory, don't hold any lock
+    virtual void MigrateStep() = 0;
+    virtual bool IsResizing() const = 0;
+    //Bumped by every resize, a walk over buckets is redone if it moved
+    virtual uint32_t GetResizeNum() const = 0;
+    //Partition of the memory digest is kept in, see BucketTable
+    virtual uint32_t GetNode(const Kvdb_Digest& digest) const {
+        return 0;
+    }
+};
+
+// The table grows or shrinks by a factor of 2 without stopping the world.
+// While resizing, both tables are reachable and every index update moves
+// BUCKET_MIGRATE_STEP buckets from the old table to the new one. A key is in
+// the new table once its old bucket is marked moved. Locks are taken by the
+// low bits of the key hash and the lock number never exceeds the bucket
+// number, so one lock covers an old bucket and the new buckets it maps to.
+// Past lock_num buckets, buckets share their locks. Lookup reads without the
+// lock, see HashBucket.
+//
+// With numa_nodes partitions, runs of INDEX_NUMA_CHUNK buckets go to the
+// partitions in turn. A partition is taken by the hash bits just above the
+// chunk, so a key stays in its partition through resizes once the table has
+// a chunk for every partition.
+template <class Slot>
+class BucketTable : public IndexTable {
+public:
+    BucketTable(uint32_t ht_size, uint32_t lock_num, uint32_t numa_nodes);
+    virtual ~BucketTable();
+
+    uint32_t GetBucketNum() const override {
+        return bucketNum_.load();
+    }
+
+    std::mutex& GetLock(const Kvdb_Digest& digest) override {
+        return locks_[KeyDigestHandle::Hash(&digest) & (lockNum_ - 1)];
+    }
+
+    void GetEntries(uint32_t no, vector<HashEntry>& entries) override;
+
+    void CheckResize(uint32_t key_num) override;
+    void MigrateStep() override;
+    bool IsResizing() const override {
+        return resizing_.load();
+    }
+    uint32_t GetResizeNum() const override {
+        return resizeNum_.load();
+    }
+    uint32_t GetNode(const Kvdb_Digest& digest) const override {
+        return (KeyDigestHandle::Hash(&digest) / INDEX_NUMA_CHUNK)
+                & (numaNodes_ - 1);
+    }
+
+protected:
+    typedef HashBucket<Slot> Bucket;
+
+    struct TableState {
+        Bucket* buckets;
+        uint32_t bucketNum;
+        Bucket* oldBuckets;
+        uint32_t oldBucketNum;
+    };
+
+    Bucket* locateBucket(TableState* st, uint32_t hash);
+    template <class Match, class Found>
+    typename Bucket::ReadResult readState(TableState* st, uint32_t hash,
+                                          uint16_t tag, Match match,
+                                          Found found);
+
+    //key hash of a slot, and the entry it stands for
+    static uint32_t slotHash(const Slot& slot);
+    static HashEntry slotEntry(const Slot& slot, uint16_t tag);
+
+    std::atomic<TableState*> state_;
+    EpochManager epoch_;
+
+private:
+    BucketTable(const BucketTable&);
+    BucketTable& operator=(const BucketTable&);
+
+    static void deleteState(void* ptr);
+    static void deleteOldTable(void* ptr);
+    void startResize(uint32_t bucket_num);
+    void migrateBucket(TableState* st, uint32_t old_no);
+    void finishResize(TableState* st);
+
+    TableState* retiredState_;
+    std::atomic<uint32_t> bucketNum_;
+    uint32_t minBucketNum_;
+    uint32_t numaNodes_;
+
+    std::mutex* locks_;
+    uint32_t lockNum_;
+
+    std::atomic<bool> resizing_;
+    std::atomic<uint32_t> resizeNum_;
+    std::mutex resizeMtx_;
+    uint32_t migrateCur_;
+};
+
+// Index of whole entries, a key is found by its digest.
+class HashTable : public BucketTable<HashEntry> {
+public:
+    HashTable(uint32_t ht_size, uint32_t lock_num = INDEX_LOCK_NUM,
+              uint32_t numa_nodes = 1);
+
+    //Copy the entry of digest out without taking its lock,
+    //return false if there is no such entry
+    bool Lookup(const Kvdb_Digest& digest, HashEntry& entry);
+
+    //Callers should hold GetLock(digest)
+    HashEntry* Get(const Kvdb_Digest& digest);
+    bool Put(const HashEntry& entry);
+    bool Remove(const Kvdb_Digest& digest);
+};
+
+// Index of the lean mode. Slots only know the fingerprint of their key, the
+// bits Hash() and Tag() take from the digest, so keys of the same fingerprint
+// share it and are told apart by the header offset of their record. Entries
+// handed out have a fingerprint digest, see KeyDigestHandle::Fingerprint.
+class LeanHashTable : public BucketTable<LeanEntry> {
+public:
+    //no record is at offset 0, the superblock is
+    static const uint64_t NO_OFFSET = 0;
+
+    LeanHashTable(uint32_t ht_size, uint32_t lock_num = INDEX_LOCK_NUM,
+                  uint32_t numa_nodes = 1);
+
+    //Entries with the fingerprint of digest, without taking the lock
+    void Lookup(const Kvdb_Digest& digest, vector<HashEntry>& entries);
+
+    //Callers should hold GetLock(digest)
+    void Get(const Kvdb_Digest& digest, vector<HashEntry>& entries);
+    //Put entry over the one of its fingerprint at old_offset, or as
+    //another one with NO_OFFSET, return true if the entry is new
+    bool Put(const HashEntry& entry, uint64_t old_offset);
+    bool Remove(const Kvdb_Digest& digest, uint64_t offset);
+};
+
+}// namespace hlkvds
+#endif //#ifndef _HLKVDS_HASHTABLE_H_
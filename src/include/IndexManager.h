@@ -4,23 +4,32 @@
 #include <string>
 #include <sys/time.h>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include <list>
+#include <vector>
+#include <set>
 
 #include "Db_Structure.h"
 #include "BlockDevice.h"
 #include "hlkvds/Options.h"
 #include "Utils.h"
 #include "KeyDigestHandle.h"
-#include "LinkedList.h"
 #include "SuperBlockManager.h"
 #include "SegmentManager.h"
-#include "Segment.h"
+#include "WorkQueue.h"
 
 using namespace std;
 
 namespace hlkvds {
 class KVSlice;
+class SegmentManager;
 class SegmentSlice;
+class IndexTable;
+class HashTable;
+class LeanHashTable;
+class PagedHashTable;
 
 class DataHeader {
 private:
@@ -31,15 +40,19 @@ private:
     uint16_t data_size;
     uint32_t data_offset;
     uint32_t next_header_offset;
+    //global write order of the record, the larger one wins
+    uint64_t seq_num;
 
 public:
     DataHeader();
 #ifdef WITH_ITERATOR
     DataHeader(const Kvdb_Digest &digest, uint16_t key_len, uint16_t data_len,
-               uint32_t data_offset, uint32_t next_header_offset);
+               uint32_t data_offset, uint32_t next_header_offset,
+               uint64_t seq_num);
 #else
     DataHeader(const Kvdb_Digest &digest, uint16_t data_size,
-               uint32_t data_offset, uint32_t next_header_offset);
+               uint32_t data_offset, uint32_t next_header_offset,
+               uint64_t seq_num);
 #endif
 
     ~DataHeader();
@@ -61,6 +74,9 @@ public:
     Kvdb_Digest GetDigest() const {
         return key_digest;
     }
+    uint64_t GetSeqNum() const {
+        return seq_num;
+    }
 
     void SetDigest(const Kvdb_Digest& digest);
 #ifdef WITH_ITERATOR
@@ -132,6 +148,9 @@ public:
     Kvdb_Digest GetKeyDigest() const {
         return header.GetDigest();
     }
+    uint64_t GetSeqNum() const {
+        return header.GetSeqNum();
+    }
     DataHeader& GetDataHeader() {
         return header;
     }
@@ -140,125 +159,131 @@ public:
 
 }__attribute__((__packed__));
 
-class HashEntry {
+// Index slots are checkpointed in ranges of INDEX_RANGE_SLOT_NUM. Every range
+// has 2 blocks on device, a checkpoint writes over the one not committed and
+// the superblock of its generation commits it. Loading takes the valid block
+// with the larger generation not above the committed one.
+//
+// Entries follow the header sorted by header offset, in format
+// INDEX_BLOCK_FORMAT: the lowest sequence number of the block as a varint,
+// then per entry the raw digest and varints of the header offset delta, the
+// sequence number delta, the key size, the data size, the data offset, and
+// the zigzag distance of the next header from the end of the data. In format
+// INDEX_BLOCK_FORMAT_LEAN an entry is the raw 4-byte hash and 2-byte tag of
+// the fingerprint, then varints of the header offset delta and the data size.
+class IndexBlockHeader {
 public:
-    class LogicStamp {
-    private:
-        KVTime segTime_;
-        int32_t keyNo_;
-    public:
-        LogicStamp() :
-            segTime_(KVTime()), keyNo_(0) {
-        }
-        LogicStamp(KVTime seg_time, int32_t key_no) :
-            segTime_(seg_time), keyNo_(key_no) {
-        }
-        LogicStamp(const LogicStamp& toBeCopied) {
-            segTime_ = toBeCopied.segTime_;
-            keyNo_ = toBeCopied.keyNo_;
-        }
-        ~LogicStamp() {
-        }
-        LogicStamp& operator=(const LogicStamp& toBeCopied) {
-            segTime_ = toBeCopied.segTime_;
-            keyNo_ = toBeCopied.keyNo_;
-            return *this;
-        }
-
-        bool operator<(const LogicStamp& toBeCopied) {
-            if ((segTime_ < toBeCopied.segTime_) || (segTime_
-                    == toBeCopied.segTime_ && (keyNo_ < toBeCopied.keyNo_))) {
-                return true;
-            }
-            return false;
-        }
-
-        bool operator>(const LogicStamp& toBeCopied) {
-            if ((segTime_ > toBeCopied.segTime_) || (segTime_
-                    == toBeCopied.segTime_ && (keyNo_ > toBeCopied.keyNo_))) {
-                return true;
-            }
-            return false;
-        }
-
-        bool operator==(const LogicStamp& toBeCopied) {
-            return ((segTime_ == toBeCopied.segTime_) && (keyNo_
-                    == toBeCopied.keyNo_));
-        }
-
-        KVTime& GetSegTime() {
-            return segTime_;
-        }
-
-        int32_t GetKeyNo() {
-            return keyNo_;
-        }
-
-        void Set(KVTime seg_time, int32_t seg_key_no) {
-            segTime_ = seg_time;
-            keyNo_ = seg_key_no;
-        }
-        };
+    //crc32c of the whole block, computed with this field as 0
+    uint32_t checksum;
+    uint32_t range_no;
+    uint64_t gen;
+    uint32_t entry_num;
+    uint16_t format;
+    //bytes of encoded entries after the header
+    uint16_t length;
+}__attribute__((__packed__));
 
+// In-memory index entry, kept inline in the hash buckets. It is the
+// on-disk entry itself, the sequence number in its header orders writes.
+class HashEntry {
+public:
         HashEntry();
-        HashEntry(HashEntryOnDisk& entry_ondisk, KVTime time_stamp, void* read_ptr);
-        HashEntry(DataHeader& data_header, uint64_t header_offset, void* read_ptr);
-        HashEntry(const HashEntry&);
-        ~HashEntry();
+        HashEntry(HashEntryOnDisk& entry_ondisk);
+        HashEntry(DataHeader& data_header, uint64_t header_offset);
         bool operator==(const HashEntry& toBeCompare) const;
-        HashEntry& operator=(const HashEntry& toBeCopied);
 
         uint64_t GetHeaderOffsetPhy() const {
-            return entryPtr_->GetHeaderOffsetPhy();
+            return entry_.GetHeaderOffsetPhy();
         }
 
 #ifdef WITH_ITERATOR
         uint16_t GetKeySize() const {
-            return entryPtr_->GetKeySize();
+            return entry_.GetKeySize();
         }
 #endif
 
         uint16_t GetDataSize() const {
-            return entryPtr_->GetDataSize();
+            return entry_.GetDataSize();
         }
 
         uint32_t GetDataOffsetInSeg() const {
-            return entryPtr_->GetDataOffsetInSeg();
+            return entry_.GetDataOffsetInSeg();
         }
 
         uint32_t GetNextHeadOffsetInSeg() const {
-            return entryPtr_->GetNextHeadOffsetInSeg();
-        }
-
-        void* GetReadCachePtr() const {
-            return cachePtr_;
+            return entry_.GetNextHeadOffsetInSeg();
         }
 
         Kvdb_Digest GetKeyDigest() const {
-            return entryPtr_->GetKeyDigest();
+            return entry_.GetKeyDigest();
         }
 
-        HashEntryOnDisk& GetEntryOnDisk() {
-            return *entryPtr_;
+        uint64_t GetSeqNum() const {
+            return entry_.GetSeqNum();
         }
 
-        LogicStamp* GetLogicStamp() {
-            return stampPtr_;
+        HashEntryOnDisk& GetEntryOnDisk() {
+            return entry_;
         }
 
         void SetKeyDigest(const Kvdb_Digest& digest);
-        void SetLogicStamp(KVTime seg_time, int32_t seg_key_no);
 
     private:
-        HashEntryOnDisk *entryPtr_;
-        LogicStamp *stampPtr_;
-        void* cachePtr_;
+        HashEntryOnDisk entry_;
 
-    };
+    }__attribute__((__packed__));
+
+// Slot of the lean index mode: the fingerprint bits of the digest, the data
+// size and a 48-bit header offset. The tag of the fingerprint is kept by the
+// bucket. The rest of the entry is in the record header on device.
+class LeanEntry {
+public:
+    LeanEntry();
+    LeanEntry(const HashEntry& entry);
 
-    
+    uint32_t GetHash() const {
+        return hash_;
+    }
+    uint16_t GetDataSize() const {
+        return dataSize_;
+    }
+    uint64_t GetHeaderOffsetPhy() const {
+        return ((uint64_t) offsetHi_ << 32) | offsetLo_;
+    }
+
+    //Entry with a fingerprint digest and without the header fields
+    //the slot doesn't keep
+    HashEntry ToEntry(uint16_t tag) const;
+
+private:
+    uint32_t hash_;
+    uint16_t dataSize_;
+    uint16_t offsetHi_;
+    uint32_t offsetLo_;
+
+}__attribute__((__packed__));
+
+// Index counters and dirty marks of the ranges are split in stripes by range,
+// a cache line apart, so index updates of different ranges don't share a
+// lock. A stripe folds its counter changes into the totals of IndexManager
+// once they reach INDEX_META_FOLD_NUM, exact totals sum every stripe.
+struct MetaStripe {
+    std::mutex mtx;
+    //guarded by mtx
+    int64_t keyDelta;
+    int64_t sizeDelta;
+    uint32_t pending;
+    uint32_t dirtyNum;
+    //padded rather than aligned, the stripes live in objects of plain new
+    char pad[64];
+
+    MetaStripe() :
+        keyDelta(0), sizeDelta(0), pending(0), dirtyNum(0) {
+    }
+};
 
     class IndexManager{
+        friend class PagedHashTable;
     public:
         static inline size_t SizeOfDataHeader() {
             return sizeof(DataHeader);
@@ -273,71 +298,226 @@ public:
         bool InitIndexForCreateDB(uint64_t offset, uint32_t numObjects);
 
         bool LoadIndexFromDevice(uint64_t offset, uint32_t ht_size);
-        bool WriteIndexToDevice();
+        //Write the ranges changed since the last checkpoint, or all of them,
+        //as checkpoint generation gen. They count once the superblock of gen
+        //is written, then call CommitCheckpoint, or AbortCheckpoint if not
+        bool WriteIndexToDevice(uint64_t gen, bool full);
+        void CommitCheckpoint();
+        void AbortCheckpoint();
+        uint32_t GetDirtyRangeNum() const;
 
         bool UpdateIndex(KVSlice* slice);
-        void UpdateIndexes(list<KVSlice*> &slice_list);
+        //Index a record read back from device, a record without data is a delete
+        bool UpdateIndex(HashEntry& entry);
+        void UpdateIndexes(vector<KVSlice*> &slice_list);
         bool GetHashEntry(KVSlice *slice);
         void RemoveEntry(HashEntry entry);
 
         uint32_t GetHashTableSize() const {
             return htSize_;
         }
+        //Index partitions, see Options::index_numa_nodes
+        uint32_t GetNumaNodes() const {
+            return numaNodes_;
+        }
 
         uint64_t GetDataTheorySize() const ;
         uint32_t GetKeyCounter() const ;
 
+        //Sequence number for a new record, it orders all writes
+        uint64_t NextSeqNum() {
+            return seqNum_.fetch_add(1);
+        }
+        uint64_t GetSeqNum() const {
+            return seqNum_.load();
+        }
+        //Make sure sequence numbers handed out from now are above seq_num
+        void AdvanceSeqNum(uint64_t seq_num);
+
+        //Sequence number for a segment write, the segment is applying to
+        //the index until SegApplied is called
+        uint64_t NextSegSeqNum();
+        void SegApplied(uint64_t seq_num);
+        //Segments from this sequence number on may not be in the index yet,
+        //a checkpoint saves it for recovery to replay from
+        uint64_t GetAppliedSeqNum();
+
+        //Remove the entries located in the segments marked in segs,
+        //return the number of entries removed
+        uint32_t DropEntriesInSegs(const vector<bool>& segs);
+
         IndexManager(BlockDevice* bdev, SuperBlockManager* sbMgr_, SegmentManager* segMgr_, Options &opt);
         ~IndexManager();
 
         bool IsSameInMem(HashEntry entry);
 
-        LinkedList<HashEntry>* GetEntryListByNo(uint32_t no) {
-            return hashtable_[no].entryList_;
+        //The index keeps fingerprints only, see LeanEntry
+        bool IsLean() const {
+            return lean_;
         }
-    public:
-        struct HashtableSlot
-        {
-            LinkedList<HashEntry> *entryList_;
-            std::mutex slotMtx_;
-            HashtableSlot()
-            {
-                entryList_ = new LinkedList<HashEntry>;
-            }
-            ~HashtableSlot()
-            {
-                delete entryList_;
-            }
-        };
+        //Entries which may be of the key of slice in the lean mode, the
+        //caller tells them apart by the record headers
+        void GetLeanEntries(KVSlice *slice, vector<HashEntry>& entries);
+        //The paged mode has many dirty pages cached, a checkpoint would
+        //write them back and let them go
+        bool NeedWriteback() const;
+
+        uint32_t GetBucketNum() const;
+        void GetEntriesByNo(uint32_t no, vector<HashEntry>& entries);
 
     private:
 
+        bool updateIndex(HashEntry& entry, bool is_insert);
+
+        //Callers should hold the table lock of digest. In the lean mode
+        //the entry is told apart from others of its fingerprint by reading
+        //their headers, or by the offset of hint. Headers in read, taken
+        //by readLeanHeaders() before the lock, are not read again
+        bool getLocked(const Kvdb_Digest& digest, HashEntry& entry,
+                       const HashEntry* hint = NULL,
+                       const vector<HashEntry>* read = NULL);
+        void readLeanHeaders(const Kvdb_Digest& digest,
+                             vector<HashEntry>& read);
+        //Put entry over old, or as a new key if old is NULL
+        void putLocked(const HashEntry& entry, const HashEntry* old);
+        void removeLocked(const HashEntry& entry);
+        bool readHeader(uint64_t offset, DataHeader& header);
+        //Read the page of range_no for the paged mode
+        bool loadPage(uint32_t range_no, vector<HashEntry>& entries);
+        //Write the ranges of layout ht_size at offset from the pages of the
+        //current layout, callers should hold every key lock
+        bool rehashPages(uint32_t ht_size, uint64_t offset, uint64_t gen);
+
         void initHashTable(uint32_t size);
         void destroyHashTable();
 
+        //A batch of UpdateIndexes split by partition, every node worker
+        //applies its part
+        struct IndexBatch {
+            vector<list<KVSlice*> > parts;
+            std::mutex mtx;
+            std::condition_variable cv;
+            uint32_t pending;
+        };
+        void startNodeThds();
+        void stopNodeThds();
+        void nodeThdEntry(uint32_t node);
+
         bool rebuildHashTable(uint64_t offset);
-        bool rebuildTime(uint64_t offset);
+        void loadThdEntry(uint64_t offset, uint64_t committed_gen);
+        bool loadRange(uint32_t range_no, char* blocks, uint64_t committed_gen,
+                       uint32_t& key_num, uint64_t& data_size);
+        bool checkBlock(char* block, uint32_t range_no);
+        //The valid copy in blocks with the largest generation not above
+        //max_gen, -1 if there is none
+        int chooseCopy(char* blocks, uint32_t range_no, uint64_t max_gen);
         bool loadDataFromDevice(void* data, uint64_t length, uint64_t offset); 
-        bool convertHashEntryFromDiskToMem(int* counter, HashEntryOnDisk* entry_ondisk);
-
-        bool persistHashTable(uint64_t offset);
-        bool persistTime(uint64_t offset);
+        uint32_t computeRegionHTSize() const;
+        uint32_t computeSlotNo(const Kvdb_Digest* digest) const {
+            return KeyDigestHandle::Hash(digest) % htSize_;
+        }
+        static uint32_t rangeSlotNum(uint32_t ht_size) {
+            return ht_size < INDEX_RANGE_SLOT_NUM ? ht_size : INDEX_RANGE_SLOT_NUM;
+        }
+        static uint32_t computeRangeNum(uint32_t ht_size) {
+            return (ht_size + rangeSlotNum(ht_size) - 1) / rangeSlotNum(ht_size);
+        }
+        static uint32_t blockDataSize() {
+            return INDEX_BLOCK_SIZE - sizeof(IndexBlockHeader);
+        }
+        uint64_t rangeOffset(uint32_t range_no, int copy) const {
+            return indexOff_ + ((uint64_t) range_no * 2 + copy) * INDEX_BLOCK_SIZE;
+        }
+        //Count a change of the key at its stripe and mark its range dirty,
+        //return about how many keys there are
+        uint32_t updateMeta(const Kvdb_Digest& digest, int64_t key_delta,
+                            int64_t size_delta);
+        //Callers should hold the stripe lock of range_no
+        void markRangeDirty(uint32_t range_no);
+        MetaStripe& rangeStripe(uint32_t range_no) {
+            return stripes_[range_no & (INDEX_META_STRIPE_NUM - 1)];
+        }
+        void lockStripes() const;
+        void unlockStripes() const;
+        //Callers should hold every stripe lock
+        uint32_t sumKeyCounter() const;
+        uint64_t sumDataTheorySize() const;
+        void clearDirtyRanges(uint32_t range_num);
+
+        uint32_t chooseHTSize(uint32_t key_num) const;
+        bool switchLayout(uint32_t ht_size, uint64_t gen);
+        void collectRange(uint32_t range_no, vector<HashEntry>& entries);
+        //return false if the entries don't fit in a block
+        bool encodeRange(uint32_t range_no, vector<HashEntry>& entries,
+                         uint64_t gen, char* buf);
+        bool decodeBlock(char* block, vector<HashEntry>& entries);
+        bool encodeLeanRange(vector<HashEntry>& entries, char* buf);
+        bool decodeLeanBlock(char* block, vector<HashEntry>& entries);
         bool writeDataToDevice(void* data, uint64_t length, uint64_t offset);
 
-        HashtableSlot *hashtable_;
+        //table_ is hashtable_, leanTable_ or pagedTable_, as the index mode
+        IndexTable *table_;
+        HashTable *hashtable_;
+        LeanHashTable *leanTable_;
+        PagedHashTable *pagedTable_;
+        bool lean_;
+        bool paged_;
         uint32_t htSize_;
-        uint32_t keyCounter_;
-        uint64_t dataTheorySize_;
+        //without what the stripes keep, see MetaStripe
+        std::atomic<uint32_t> keyCounter_;
+        std::atomic<uint64_t> dataTheorySize_;
         uint64_t startOff_;
         BlockDevice* bdev_;
         SuperBlockManager* sbMgr_;
         SegmentManager* segMgr_;
         Options &options_;
 
-        KVTime* lastTime_;
+        //the index is in the index region, or relocated to segments
+        uint64_t indexOff_;
+        uint32_t indexSegNum_;
+        //committed block of every range, only the checkpoint changes it.
+        //The paged mode learns it as pages are read after a clean open
+        vector<uint8_t> rangeCopy_;
+        enum { RANGE_COPY_UNKNOWN = 2 };
+        //the paged mode reads pages from blocks not above loadGen_, blocks
+        //above are of a checkpoint not committed yet
+        uint64_t loadGen_;
+        //guarded by the stripe of the range
+        vector<uint8_t> dirtyRanges_;
+        mutable MetaStripe stripes_[INDEX_META_STRIPE_NUM];
+        //guarded by mtx_
+        bool needFull_;
+        bool overflow_;
+
+        //the checkpoint waiting for its commit
+        vector<uint32_t> ckptRanges_;
+        //page versions of ckptRanges_ in the paged mode, the pages turn
+        //clean when ckptGen_ is committed
+        vector<uint64_t> ckptVersions_;
+        uint64_t ckptGen_;
+        bool ckptFull_;
+        bool ckptRelocated_;
+        uint32_t oldHtSize_;
+        uint64_t oldIndexOff_;
+        uint32_t oldIndexSegNum_;
+        vector<uint8_t> oldRangeCopy_;
+
+        std::atomic<uint64_t> seqNum_;
+        std::multiset<uint64_t> applyingSegs_;
+        std::mutex seqMtx_;
         mutable std::mutex mtx_;
         std::mutex batch_mtx_;
 
+        //index partitions, a worker bound to its node for every one
+        uint32_t numaNodes_;
+        vector<WorkQueue<IndexBatch*>*> nodeQues_;
+        vector<std::thread> nodeThds_;
+        std::atomic<bool> nodeThdStop_;
+
+        //next range for the loader threads to take
+        std::atomic<uint32_t> loadRangeNo_;
+        std::atomic<bool> loadFailed_;
+
     };
 
 
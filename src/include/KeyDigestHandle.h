@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <string>
 #include "rmd160.h"
+#include "rmd160_mb.h"
+#include "murmur3.h"
 
 #include "Db_Structure.h"
+#include "hlkvds/Options.h"
 
 //#define RMDsize 160
 //#define DIGEST_LEN RMDsize/8
@@ -57,13 +60,22 @@ public:
         return sizeof(Kvdb_Digest);
     }
 
-    static uint32_t Hash(const Kvdb_Key *key);
+    static uint32_t Hash(const Kvdb_Key *key, int type = DIGEST_RMD160);
     static uint32_t Hash(const Kvdb_Digest *digest);
+    static uint16_t Tag(const Kvdb_Digest *digest);
+    //Digest with only the bits of Hash() and Tag() set, all the lean
+    //index keeps of a key
+    static Kvdb_Digest Fingerprint(uint32_t hash, uint16_t tag);
     static void ComputeDigest(const Kvdb_Key *key, Kvdb_Digest &digest);
+    static void ComputeDigest(const Kvdb_Key *key, Kvdb_Digest &digest,
+                              int type);
+    static void ComputeDigests(const Kvdb_Key *keys, Kvdb_Digest *digests,
+                               int num, int type);
     static string Tostring(Kvdb_Digest *digest);
 
 private:
     KeyDigestHandle();
+    static void computeMurmur3(const Kvdb_Key *key, Kvdb_Digest &digest);
 
 };
 }// namespace hlkvds
@@ -2,6 +2,7 @@
 #define _HLKVDS_KVDBITER_H_
 
 #include <string>
+#include <vector>
 #include "hlkvds/Iterator.h"
 #include "Db_Structure.h"
 
@@ -15,7 +16,8 @@ class HashEntry;
 
 class KvdbIter : public Iterator {
 public:
-    KvdbIter(IndexManager* im, SegmentManager* sm, BlockDevice* bdev);
+    KvdbIter(IndexManager* im, SegmentManager* sm, BlockDevice* bdev,
+             int digest_type);
     ~KvdbIter();
 
     virtual void SeekToFirst() override;
@@ -31,16 +33,19 @@ public:
     virtual Status status() const override;
 
 private:
+    int loadEntryList(int no);
+
     IndexManager *idxMgr_;
     SegmentManager *segMgr_;
     BlockDevice* bdev_;
     bool valid_;
     HashEntry *hashEntry_;
+    std::vector<HashEntry> entryList_;
     Status status_;
-    //HashtableSlot *ht_;
     int htSize_;
     int hashTableCur_;
     int entryListCur_;
+    int digestType_;
 };
 } 
 #endif
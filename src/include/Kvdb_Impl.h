@@ -2,22 +2,26 @@
 #define _HLKVDS_KVDB_IMPL_H_
 
 #include <list>
+#include <set>
 #include <queue>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <future>
 
 #include "Db_Structure.h"
 #include "hlkvds/Options.h"
 #include "hlkvds/Status.h"
 #include "hlkvds/Write_batch.h"
 #include "hlkvds/Iterator.h"
+#include "hlkvds/Callback.h"
 #include "BlockDevice.h"
 #include "SuperBlockManager.h"
 #include "IndexManager.h"
 #include "SegmentManager.h"
 #include "GcManager.h"
+#include "CheckpointManager.h"
 #include "WorkQueue.h"
 #include "Segment.h"
 
@@ -29,12 +33,31 @@ public:
     static KVDS* Open_KVDS(const char* filename, Options opts);
 
     Status Insert(const char* key, uint32_t key_len, const char* data,
-                  uint16_t length);
+                  uint16_t length, const WriteOptions& wopts = WriteOptions());
     Status Get(const char* key, uint32_t key_len, string &data);
-    Status Delete(const char* key, uint32_t key_len);
+    Status Delete(const char* key, uint32_t key_len,
+                  const WriteOptions& wopts = WriteOptions());
 
     Status InsertBatch(WriteBatch *batch);
 
+    //The asynchronous calls copy key and data and return at once. The
+    //result is given to the callback, or set in the future. Writes queued
+    //before the DB is closed complete before the close returns
+    void InsertAsync(const char* key, uint32_t key_len, const char* data,
+                     uint16_t length, WriteCallback cb,
+                     const WriteOptions& wopts = WriteOptions());
+    std::future<Status> InsertAsync(const char* key, uint32_t key_len,
+                                    const char* data, uint16_t length,
+                                    const WriteOptions& wopts = WriteOptions());
+    void DeleteAsync(const char* key, uint32_t key_len, WriteCallback cb,
+                     const WriteOptions& wopts = WriteOptions());
+    std::future<Status> DeleteAsync(const char* key, uint32_t key_len,
+                                    const WriteOptions& wopts = WriteOptions());
+    void GetAsync(const char* key, uint32_t key_len, ReadCallback cb);
+    //data is set before the future is ready
+    std::future<Status> GetAsync(const char* key, uint32_t key_len,
+                                 string &data);
+
     Iterator* NewIterator();
 
     void Do_GC();
@@ -44,10 +67,17 @@ public:
     void printDbStates();
 
     uint32_t getReqQueSize() {
-        return reqQue_.length();
+        uint32_t len = 0;
+        for (uint32_t i = 0; i < shards_.size(); i++) {
+            len += shards_[i]->reqQue.length();
+        }
+        return len;
     }
     uint32_t getSegWriteQueSize() {
-        return segWriteQue_.length();
+        return segWriteQue_.length() + segUrgentQue_.length();
+    }
+    uint32_t getSegUrgentQueSize() {
+        return segUrgentQue_.length();
     }
     uint32_t getSegReaperQueSize() {
         return segReaperQue_.length();
@@ -59,15 +89,19 @@ private:
     KVDS(const string& filename, Options opts);
     Status openDB();
     Status closeDB();
-    bool writeMetaDataToDevice();
+    bool writeMetaDataToDevice(bool full);
     bool readMetaDataFromDevice();
     void startThds();
     void stopThds();
 
-    Status insertKey(KVSlice& slice);
+    Status checkInsert(const char* key, uint16_t length);
+    Status insertKey(KVSlice& slice, const WriteOptions& wopts);
     Status updateMeta(Request *req);
 
     Status readData(KVSlice& slice, string &data);
+    //Get of the lean index mode, reads the record of every candidate
+    //entry until the header digest is the one of the key
+    Status readLean(KVSlice& slice, string &data);
 
 private:
     SuperBlockManager* sbMgr_;
@@ -75,38 +109,82 @@ private:
     BlockDevice* bdev_;
     SegmentManager* segMgr_;
     GcManager* gcMgr_;
+    CheckpointManager* ckptMgr_;
     string fileName_;
 
-    SegForReq *seg_;
-    std::mutex segMtx_;
     Options options_;
 
-    // Request Merge thread
+    // Request Merge threads, every one fills the open segment of its
+    // shard and decides when to flush it. Requests of a key always go to
+    // the same shard
 private:
-    std::thread reqMergeT_;
+    struct ReqShard {
+        SegForReq *seg;
+        WorkQueue<Request*> reqQue;
+        std::thread reqMergeT;
+    };
+    std::vector<ReqShard*> shards_;
     std::atomic<bool> reqMergeT_stop_;
-    WorkQueue<Request*> reqQue_;
-    void ReqMergeThdEntry();
-
-    // Seg Write to device thread
+    ReqShard* chooseShard(const KVSlice& slice);
+    void flushShard(ReqShard* shard);
+    void putToShard(ReqShard* shard, Request** reqs, uint32_t num);
+    //merge and flush what is left in the shard, its thread is stopped
+    void drainShard(ReqShard* shard);
+
+    // Reaped segments wait here to be the open segment of a shard again,
+    // up to segPoolMax_ of them
+    std::vector<SegForReq*> segPool_;
+    uint32_t segPoolMax_;
+    std::mutex segPoolMtx_;
+    SegForReq* newSegForReq();
+    void recycleSeg(SegForReq* seg);
+    void ReqMergeThdEntry(uint32_t shard_no);
+
+    // Seg Write to device thread, segments of urgent requests go through
+    // segUrgentQue_ ahead of the others
 private:
     std::vector<std::thread> segWriteTP_;
     std::atomic<bool> segWriteT_stop_;
+    EventCount segQueEvent_;
     WorkQueue<SegForReq*> segWriteQue_;
+    WorkQueue<SegForReq*> segUrgentQue_;
+    SegForReq* dequeueSegToWrite();
+    SegForReq* waitSegToWrite();
     void SegWriteThdEntry();
 
-    // Seg Timeout thread
-private:
-    std::thread segTimeoutT_;
-    std::atomic<bool> segTimeoutT_stop_;
-    void SegTimeoutThdEntry();
-
     // Seg Reaper thread
 private:
     std::thread segReaperT_;
     std::atomic<bool> segReaperT_stop_;
     WorkQueue<SegForReq*> segReaperQue_;
     void SegReaperThdEntry();
+    void reapSegs(std::list<SegForReq*>& segs, bool force);
+
+    // Sealed segments, of requests or batches, not fully in the index yet,
+    // by their first sequence number. Segments may be written and applied
+    // out of order, so the deletes of one leave the index only once all
+    // sealed before it are in. Otherwise an older write of a key applied
+    // late brings it back
+    std::multiset<uint64_t> unappliedSegs_;
+    std::mutex unappliedMtx_;
+    void segSealed(uint64_t first_seq);
+    //a sequence number sealed at once, for a batch whose keys may be in
+    //any shard and so sealed before a later segment of theirs could be
+    uint64_t sealedNextSeqNum();
+    void segApplied(uint64_t first_seq);
+    bool allSegsApplied();
+    bool olderSegsApplied(SegForReq* seg);
+
+    // Read threads of GetAsync
+private:
+    struct ReadReq {
+        string key;
+        ReadCallback cb;
+    };
+    std::vector<std::thread> readTP_;
+    std::atomic<bool> readT_stop_;
+    WorkQueue<ReadReq*> readQue_;
+    void ReadThdEntry();
 
     //GC thread
 private:
@@ -114,6 +192,13 @@ private:
     std::atomic<bool> gcT_stop_;
 
     void GCThdEntry();
+
+    //Checkpoint thread
+private:
+    std::thread ckptT_;
+    std::atomic<bool> ckptT_stop_;
+
+    void CkptThdEntry();
 };
 
 } // namespace hlkvds
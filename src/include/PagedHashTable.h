@@ -0,0 +1,113 @@
+#ifndef _HLKVDS_PAGEDHASHTABLE_H_
+#define _HLKVDS_PAGEDHASHTABLE_H_
+
+#include <stdint.h>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <vector>
+
+#include "Db_Structure.h"
+#include "KeyDigestHandle.h"
+#include "IndexManager.h"
+#include "HashTable.h"
+
+using namespace std;
+
+namespace hlkvds {
+
+// Index of the paged mode, for more keys than fit in DRAM. Its bucket pages
+// are the index ranges on device, see IndexBlockHeader. A bounded cache
+// keeps the pages in use. A missing page is read from its block, and the
+// least recently used clean page makes room for it. A changed page is dirty
+// and stays cached until a checkpoint has written its block.
+//
+// Keys are locked by their hash, not by their page, so the index manager
+// can hold every lock while it changes the layout. The entries of a page
+// are guarded by the page mutex.
+class PagedHashTable : public IndexTable {
+public:
+    PagedHashTable(IndexManager* im, uint32_t cache_pages, uint32_t lock_num);
+    ~PagedHashTable();
+
+    //A bucket is a page here
+    uint32_t GetBucketNum() const override;
+    std::mutex& GetLock(const Kvdb_Digest& digest) override {
+        return locks_[KeyDigestHandle::Hash(&digest) & (lockNum_ - 1)];
+    }
+    void GetEntries(uint32_t no, vector<HashEntry>& entries) override;
+
+    //The layout only changes at checkpoints, see IndexManager::switchLayout
+    void CheckResize(uint32_t key_num) override {
+    }
+    void MigrateStep() override {
+    }
+    bool IsResizing() const override {
+        return false;
+    }
+    uint32_t GetResizeNum() const override {
+        return 0;
+    }
+
+    //Callers should hold GetLock(digest)
+    bool Get(const Kvdb_Digest& digest, HashEntry& entry);
+    bool Put(const HashEntry& entry);
+    bool Remove(const Kvdb_Digest& digest);
+
+    //Entries of page no for a checkpoint, pass version to SetClean once
+    //they are written. The page stays dirty if it changed in between
+    bool Snapshot(uint32_t no, vector<HashEntry>& entries, uint64_t& version);
+    void SetClean(uint32_t no, uint64_t version);
+    uint32_t GetDirtyPageNum() const;
+    //Dirty pages fill half of the cache, they should be written back
+    bool NeedWriteback() const;
+
+    //For a layout change, with every key lock held: drop all pages once
+    //nobody uses them, the page number is taken from the new layout
+    void LockAll();
+    void UnlockAll();
+    void Clear();
+
+private:
+    struct Page {
+        uint32_t no;
+        std::mutex mtx;
+        //guarded by mtx
+        bool loaded;
+        vector<HashEntry> entries;
+        //changed holding both mtx and cacheMtx_
+        uint64_t version;
+        //guarded by cacheMtx_
+        bool dirty;
+        int pins;
+        list<Page*>::iterator lruIter;
+    };
+
+    PagedHashTable(const PagedHashTable&);
+    PagedHashTable& operator=(const PagedHashTable&);
+
+    //The page pinned, locked and loaded, NULL if it could not be read
+    Page* getPage(uint32_t no);
+    void putPage(Page* page, bool changed);
+    void unpin(Page* page);
+    //Callers should hold cacheMtx_
+    void evict();
+    uint32_t pageNo(const Kvdb_Digest& digest) const;
+    static int find(Page* page, const Kvdb_Digest& digest);
+
+    IndexManager* idxMgr_;
+    uint32_t capacity_;
+    std::mutex* locks_;
+    uint32_t lockNum_;
+
+    vector<Page*> pages_;
+    //cached pages, the most recently used first
+    list<Page*> lru_;
+    uint32_t dirtyNum_;
+    uint32_t pinNum_;
+    mutable std::mutex cacheMtx_;
+    std::condition_variable cacheCv_;
+};
+
+}// namespace hlkvds
+#endif //#ifndef _HLKVDS_PAGEDHASHTABLE_H_
@@ -0,0 +1,71 @@
+#ifndef _HLKVDS_RECOVERYMANAGER_H_
+#define _HLKVDS_RECOVERYMANAGER_H_
+
+#include <sys/types.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Db_Structure.h"
+#include "BlockDevice.h"
+#include "hlkvds/Options.h"
+#include "IndexManager.h"
+#include "SegmentManager.h"
+
+using namespace std;
+
+namespace hlkvds {
+
+// After an unclean shutdown the index on device is the one written by the
+// last checkpoint. Every segment write takes a sequence number, and the
+// checkpoint saves the lowest one not fully applied to the index when it
+// started, segments from there on may be missing from it. Recovery scans the segment headers in parallel, reads back the
+// records of those segments, and replays them into the index in segment
+// order. Index entries pointing into a rewritten segment are dropped first,
+// the records there are the only valid ones. A segment whose checksum
+// doesn't match was torn by the crash, it's freed.
+//
+// A key deleted after the checkpoint may come back if GC dropped its delete
+// record before the crash, GC never copies delete records.
+class RecoveryManager {
+public:
+    RecoveryManager(BlockDevice* bdev, IndexManager* im, SegmentManager* sm,
+                    Options &opt);
+    ~RecoveryManager();
+
+    //checkpoint_seq is the sequence number saved by the last checkpoint
+    bool Recover(uint64_t checkpoint_seq);
+
+private:
+    struct SegScan {
+        uint32_t segId;
+        uint64_t seqNum;
+        uint32_t freeSize;
+        vector<HashEntry> entries;
+    };
+
+    RecoveryManager(const RecoveryManager&);
+    RecoveryManager& operator=(const RecoveryManager&);
+
+    void scanThdEntry(uint64_t checkpoint_seq);
+    bool scanSegment(uint32_t seg_id, uint64_t checkpoint_seq, char* buf);
+    bool loadSegEntries(SegScan& scan, const SegmentOnDisk& seg_disk,
+                        uint64_t seg_offset, const char* buf);
+
+private:
+    SegmentManager* segMgr_;
+    IndexManager* idxMgr_;
+    BlockDevice* bdev_;
+    Options &options_;
+
+    std::atomic<uint32_t> nextSegId_;
+    std::atomic<bool> failed_;
+    vector<bool> rewritten_;
+    vector<SegScan> scans_;
+    vector<uint32_t> tornSegs_;
+    std::mutex mtx_;
+};
+
+}//namespace hlkvds
+
+#endif //#ifndef _HLKVDS_RECOVERYMANAGER_H_
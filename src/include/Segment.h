@@ -5,7 +5,9 @@
 #include <sys/types.h>
 
 #include <list>
+#include <vector>
 #include <mutex>
+#include <functional>
 #include <condition_variable>
 #include <atomic>
 
@@ -35,7 +37,11 @@ public:
     KVSlice(const KVSlice& toBeCopied);
     KVSlice& operator=(const KVSlice& toBeCopied);
 
-    KVSlice(const char* key, int key_len, const char* data, int data_len, bool deep_copy = false);
+    //digest is left unset with NO_DIGEST, see ComputeDigest()
+    static const int NO_DIGEST = -1;
+
+    KVSlice(const char* key, int key_len, const char* data, int data_len,
+            bool deep_copy = false, int digest_type = DIGEST_RMD160);
 #ifdef WITH_ITERATOR
     KVSlice(Kvdb_Digest *digest, const char* key, int key_len,
             const char* data, int data_len);
@@ -77,9 +83,17 @@ public:
         return segId_;
     }
 
-    void SetKeyValue(const char* key, int key_len, const char* data, int data_len);
+    uint64_t GetSeqNum() const {
+        return seqNum_;
+    }
+
+    void SetKeyValue(const char* key, int key_len, const char* data,
+                     int data_len, int digest_type = DIGEST_RMD160);
+    void ComputeDigest(int digest_type);
+    static void ComputeDigests(std::list<KVSlice *> &slices, int digest_type);
     void SetHashEntry(const HashEntry *hash_entry);
     void SetSegId(uint32_t seg_id);
+    void SetSeqNum(uint64_t seq_num);
 
 
 private:
@@ -87,13 +101,18 @@ private:
     uint32_t keyLength_;
     const char* data_;
     uint16_t dataLength_;
+    //point to digestBuf_ and entryBuf_ once set, a slice allocates nothing
+    //of its own
     Kvdb_Digest *digest_;
     HashEntry *entry_;
+    Kvdb_Digest digestBuf_;
+    HashEntry entryBuf_;
     uint32_t segId_;
+    uint64_t seqNum_;
     bool deepCopy_;
 
     void copy_helper(const KVSlice& toBeCopied);
-    void computeDigest();
+    void computeDigest(int digest_type);
 
 };
 
@@ -130,13 +149,36 @@ public:
         return segPtr_;
     }
 
+    void SetWriteOptions(const WriteOptions& wopts) {
+        maxLatency_ = wopts.max_latency > 0 ? wopts.max_latency : 0;
+        urgent_ = wopts.urgent;
+    }
+
+    //microseconds, 0 for no limit of its own
+    uint32_t GetMaxLatency() const {
+        return maxLatency_;
+    }
+
+    bool IsUrgent() const {
+        return urgent_;
+    }
+
+    //Run done instead of waking a waiter once the request is written,
+    //done may delete the request
+    void SetDone(std::function<void(Request*)> done) {
+        done_cb_ = done;
+    }
+
     void Wait();
     void Signal();
 
 private:
     bool done_;
+    std::function<void(Request*)> done_cb_;
     ReqStat stat_;
     KVSlice *slice_;
+    uint32_t maxLatency_;
+    bool urgent_;
     mutable std::mutex mtx_;
     std::condition_variable cv_;
 
@@ -151,9 +193,13 @@ public:
     SegBase& operator=(const SegBase& toBeCopied);
     SegBase(SegmentManager* sm, BlockDevice* bdev);
 
+    //False if the slice doesn't fit or there is no memory for the segment
+    //buffer. Put only a slice TryPut took
     bool TryPut(KVSlice* slice);
     void Put(KVSlice* slice);
     bool WriteSegToDevice();
+    //Give the buffer back once the segment is written
+    void ReleaseDataBuf();
     uint32_t GetFreeSize() const {
         return tailPos_ - headPos_;
     }
@@ -161,6 +207,9 @@ public:
     int32_t GetSegId() const {
         return segId_;
     }
+    //Sequence number of the segment write, set it before WriteSegToDevice
+    void SetSeqNum(uint64_t seq_num);
+    uint64_t GetSeqNum() const;
     void SetSegId(int32_t seg_id) {
         segId_ = seg_id;
     }
@@ -169,15 +218,19 @@ public:
         return keyNum_;
     }
 
-    std::list<KVSlice *>& GetSliceList() {
+    std::vector<KVSlice *>& GetSliceList() {
         return sliceList_;
     }
 
+protected:
+    //Empty the segment to use it again
+    void reset();
+
 private:
     void copyHelper(const SegBase& toBeCopied);
     void fillEntryToSlice();
     bool _writeDataToDevice();
-    void copyToDataBuf();
+    void sealDataBuf();
     bool newDataBuffer();
 
 private:
@@ -193,7 +246,8 @@ private:
     int32_t keyNum_;
     int32_t keyAlignedNum_;
 
-    std::list<KVSlice *> sliceList_;
+    //vectors keep their room while the segment is recycled
+    std::vector<KVSlice *> sliceList_;
 
     SegmentOnDisk *segOndisk_;
     char *dataBuf_;
@@ -207,12 +261,26 @@ public:
     SegForReq& operator=(const SegForReq& toBeCopied);
 
     SegForReq(SegmentManager* sm, IndexManager* im, BlockDevice* bdev, uint32_t timeout);
+    //Empty a reaped segment to take requests again
+    void Reset(uint32_t timeout);
 
     bool TryPut(Request* req);
     void Put(Request* req);
     void Complete();
     void Notify(bool stat);
-    bool IsExpired();
+    //Microseconds the segment may still wait for more requests, within
+    //the max latency of every request in it
+    int64_t GetTimeLeft();
+
+    //holds an urgent request
+    bool IsUrgent() const {
+        return urgent_;
+    }
+
+    //sequence number of the first request put, every later one is larger
+    uint64_t GetFirstSeqNum() const {
+        return firstSeq_;
+    }
 
     int32_t CommitedAndGetNum() {
         return --reqCommited_;
@@ -224,16 +292,17 @@ private:
     IndexManager* idxMgr_;
     uint32_t timeout_;
     KVTime startTime_;
-    KVTime persistTime_;
 
     bool isCompleted_;
     bool hasReq_;
+    bool urgent_;
+    uint64_t firstSeq_;
 
     std::atomic<int32_t> reqCommited_;
-    std::list<Request *> reqList_;
+    std::vector<Request *> reqList_;
 
     mutable std::mutex mtx_;
-    std::list<HashEntry> delReqList_;
+    std::vector<HashEntry> delReqList_;
 };
 
 class SegForSlice : public SegBase {
@@ -24,14 +24,18 @@ class IndexManager;
 enum struct SegUseStat {
     FREE,
     USED,
-    RESERVED
+    RESERVED,
+    INDEX
 };
 
 class SegmentOnDisk {
 public:
     uint64_t time_stamp;
+    //crc32c of the whole segment, computed with this field as 0
     uint32_t checksum;
     uint32_t number_keys;
+    //taken when the segment is written, orders it against the checkpoint
+    uint64_t seq_num;
 public:
     SegmentOnDisk();
     ~SegmentOnDisk();
@@ -43,6 +47,9 @@ public:
     void SetKeyNum(uint32_t num) {
         number_keys = num;
     }
+    void SetSeqNum(uint64_t seq) {
+        seq_num = seq;
+    }
 };
 
 class SegmentStat {
@@ -83,7 +90,9 @@ public:
     bool LoadSegmentTableFromDevice(uint64_t start_offset,
                                     uint32_t segment_size, uint32_t num_seg,
                                     uint32_t current_seg);
-    bool WriteSegmentTableToDevice();
+    //Write the whole table, or only the pages changed since the last write
+    bool WriteSegmentTableToDevice(bool only_dirty = false);
+    uint32_t GetDirtyPageNum();
 
     uint32_t GetNowSegId() {
         return curSegId_;
@@ -129,19 +138,46 @@ public:
     void FreeForFailed(uint32_t seg_id);
     void FreeForGC(uint32_t seg_id);
     void Use(uint32_t seg_id, uint32_t free_size);
+    bool AllocForIndex(uint32_t seg_num, uint32_t& first_seg_id);
+    void FreeForIndex(uint32_t first_seg_id, uint32_t seg_num);
     void ModifyDeathEntry(HashEntry &entry);
 
+    //Segment states recovery finds on device: written after the checkpoint,
+    //or torn by a crash while being written
+    void UseForRecovery(uint32_t seg_id, uint32_t free_size);
+    void FreeForRecovery(uint32_t seg_id);
+    bool IsIndexSeg(uint32_t seg_id);
+    //Make exactly these segments hold the index, index segments left by a
+    //relocation a crash cut off are freed
+    void SetIndexSegs(uint32_t first_seg_id, uint32_t seg_num);
+
     void SortSegsByUtils(std::multimap<uint32_t, uint32_t> &cand_map,
                          double utils);
 
     uint32_t GetTotalFreeSegs();
     uint32_t GetTotalUsedSegs();
+    //Data segments GC freed so far, a record read at an offset is still
+    //there while this doesn't change
+    uint64_t GetGCFreedSegs();
+
+    //Aligned buffer of a segment, from the pool while it has one. NULL if
+    //there is no memory. Put it back with PutSegBuf
+    char* GetSegBuf();
+    void PutSegBuf(char* buf);
 
     SegmentManager(BlockDevice* bdev, SuperBlockManager* sbMgr_, Options &opt);
     ~SegmentManager();
 
 private:
+    void initDirtyPages();
+    //Callers should hold mtx_
+    void markDirty(uint32_t seg_id);
+    void fillTablePage(uint32_t page, char* buf);
+    void initSegBufs();
+
     vector<SegmentStat> segTable_;
+    vector<bool> dirtyPages_;
+    uint32_t dirtyPageNum_;
     uint64_t startOff_;
     uint64_t dataStartOff_;
     uint64_t dataEndOff_;
@@ -152,6 +188,7 @@ private:
     uint32_t usedCounter_;
     uint32_t freedCounter_;
     uint32_t reservedCounter_;
+    uint64_t gcFreedCounter_;
     uint32_t maxValueLen_;
 
     BlockDevice* bdev_;
@@ -159,6 +196,13 @@ private:
     Options &options_;
     mutable std::mutex mtx_;
 
+    //Segment buffers in use at once: one per open segment, write thread
+    //and GC segment. They are cut from one slab, faulted in up front
+    char* bufSlab_;
+    uint32_t bufNum_;
+    std::vector<char*> freeBufs_;
+    std::mutex bufMtx_;
+
 };
 
 } //end namespace hlkvds
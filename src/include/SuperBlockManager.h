@@ -29,27 +29,57 @@ public:
     uint64_t db_data_region_size;
     uint64_t device_capacity;
     uint64_t data_theory_size;
+    //index relocated to data segments when outgrowing its region,
+    //index_seg_num is 0 while the index is in the index region
+    uint64_t index_offset;
+    uint32_t index_seg_num;
+    //0 while the DB is open, the index on device may then be stale
+    uint32_t clean_shutdown;
+    //the superblock is kept in 2 copies, a checkpoint is committed by
+    //writing the copy of its generation
+    uint64_t checkpoint_gen;
+    //segments from checkpoint_seq on are replayed after a crash,
+    //sequence numbers carry on from next_seq
+    uint64_t checkpoint_seq;
+    uint64_t next_seq;
+    //key digest function chosen at creation, see Options::digest_type
+    uint32_t digest_type;
+    //see Options::index_mode
+    uint32_t index_mode;
+    //crc32c of the copy, computed with this field as 0
+    uint32_t checksum;
 
 public:
     DBSuperBlock(uint32_t magic, uint32_t ht_size, uint32_t num_eles,
                  uint32_t seg_size, uint32_t num_seg, uint32_t cur_seg,
                  uint64_t sb_size, uint64_t index_size,
                  uint64_t seg_table_size, uint64_t data_region_size,
-                 uint64_t dev_size, uint64_t data_size) :
+                 uint64_t dev_size, uint64_t data_size,
+                 uint64_t idx_offset = 0, uint32_t idx_seg_num = 0,
+                 uint32_t digest = DIGEST_RMD160,
+                 uint32_t idx_mode = INDEX_MODE_FULL) :
         magic_number(magic), hashtable_size(ht_size),
                 number_elements(num_eles), segment_size(seg_size),
                 number_segments(num_seg), current_segment(cur_seg),
                 db_sb_size(sb_size), db_index_size(index_size),
                 db_seg_table_size(seg_table_size),
                 db_data_region_size(data_region_size),
-                device_capacity(dev_size), data_theory_size(data_size) {
+                device_capacity(dev_size), data_theory_size(data_size),
+                index_offset(idx_offset), index_seg_num(idx_seg_num),
+                clean_shutdown(0), checkpoint_gen(0), checkpoint_seq(0),
+                next_seq(0), digest_type(digest), index_mode(idx_mode),
+                checksum(0) {
     }
 
     DBSuperBlock() :
         magic_number(0), hashtable_size(0), number_elements(0),
                 segment_size(0), number_segments(0), current_segment(0),
                 db_sb_size(0), db_index_size(0), db_seg_table_size(0),
-                db_data_region_size(0), device_capacity(0), data_theory_size(0) {
+                db_data_region_size(0), device_capacity(0), data_theory_size(0),
+                index_offset(0), index_seg_num(0), clean_shutdown(0),
+                checkpoint_gen(0), checkpoint_seq(0), next_seq(0),
+                digest_type(DIGEST_RMD160), index_mode(INDEX_MODE_FULL),
+                checksum(0) {
     }
 
     uint32_t GetMagic() const {
@@ -88,6 +118,30 @@ public:
     uint64_t GetDataTheorySize() const {
         return data_theory_size;
     }
+    uint64_t GetIndexOffset() const {
+        return index_offset;
+    }
+    uint32_t GetIndexSegNum() const {
+        return index_seg_num;
+    }
+    bool IsCleanShutdown() const {
+        return clean_shutdown != 0;
+    }
+    uint64_t GetCheckpointGen() const {
+        return checkpoint_gen;
+    }
+    uint64_t GetCheckpointSeqNum() const {
+        return checkpoint_seq;
+    }
+    uint64_t GetNextSeqNum() const {
+        return next_seq;
+    }
+    uint32_t GetDigestType() const {
+        return digest_type;
+    }
+    uint32_t GetIndexMode() const {
+        return index_mode;
+    }
 
     ~DBSuperBlock() {
     }
@@ -102,7 +156,9 @@ public:
 
     bool InitSuperBlockForCreateDB(uint64_t offset);
 
+    //Load the valid copy with the larger generation
     bool LoadSuperBlockFromDevice(uint64_t offset);
+    //Write the next generation over the older copy, this commits a checkpoint
     bool WriteSuperBlockToDevice();
 
     void SetSuperBlock(DBSuperBlock& sb);
@@ -149,15 +205,46 @@ public:
     uint64_t GetDataTheorySize() const {
         return sb_->data_theory_size;
     }
+    uint64_t GetIndexOffset() const {
+        return sb_->index_offset;
+    }
+    uint32_t GetIndexSegNum() const {
+        return sb_->index_seg_num;
+    }
+    bool IsCleanShutdown() const {
+        return sb_->clean_shutdown != 0;
+    }
+    uint64_t GetCheckpointGen() const {
+        return sb_->checkpoint_gen;
+    }
+    uint64_t GetCheckpointSeqNum() const {
+        return sb_->checkpoint_seq;
+    }
+    uint64_t GetNextSeqNum() const {
+        return sb_->next_seq;
+    }
+    uint32_t GetDigestType() const {
+        return sb_->digest_type;
+    }
+    uint32_t GetIndexMode() const {
+        return sb_->index_mode;
+    }
 
+    void SetHTSize(uint32_t size);
+    void SetIndexLocation(uint64_t offset, uint32_t seg_num);
     void SetElementNum(uint32_t num);
     void SetCurSegId(uint32_t id);
     void SetDataTheorySize(uint64_t size);
+    void SetCleanShutdown(bool clean);
+    void SetCheckpointSeqNum(uint64_t checkpoint_seq, uint64_t next_seq);
 
     SuperBlockManager(BlockDevice* bdev, Options &opt);
     ~SuperBlockManager();
 
 private:
+    static uint64_t sizeOfCopyOnDevice();
+    static bool isValidCopy(const DBSuperBlock& sb);
+
     BlockDevice* bdev_;
     DBSuperBlock* sb_;
 
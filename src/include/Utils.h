@@ -38,6 +38,63 @@ private:
 
 };
 
+// CRC-32C, with the SSE4.2 instruction when the cpu has it
+class KVCrc {
+public:
+    static uint32_t Crc32c(uint32_t crc, const void* data, size_t len);
+};
+
+// LEB128 varint, 7 bits a byte from the low bits on. Signed values go
+// through zigzag so small negative ones stay short.
+class KVVarint {
+public:
+    static const int MaxSize = 10;
+
+    //Write value to buf, return the bytes written
+    static int Encode(uint64_t value, char* buf);
+    //Read a value from at most len bytes of buf, return the bytes read,
+    //or 0 if it's cut short
+    static int Decode(const char* buf, size_t len, uint64_t& value);
+
+    static uint64_t ZigZag(int64_t value) {
+        return ((uint64_t) value << 1) ^ (uint64_t)(value >> 63);
+    }
+    static int64_t UnZigZag(uint64_t value) {
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+};
+
+// NUMA placement by the kernel interfaces, without libnuma. Placement is a
+// hint, a host or kernel without NUMA just ignores it.
+class KVNuma {
+public:
+    //Nodes of the host, 1 if it has no NUMA
+    static int NodeNum();
+    //Prefer node for the pages in [addr, addr + len), before they are touched
+    static bool BindMemory(void* addr, size_t len, int node);
+    //Run the calling thread on the cpus of node
+    static bool BindThread(int node);
+};
+
+// Large long-lived buffers on huge pages: pages of hugetlbfs if the host
+// reserved some, else transparent huge pages asked for by madvise, else
+// plain pages. Buffers below HUGE_PAGE_SIZE are plain aligned memory.
+class KVHugeMem {
+public:
+    //align is up to 4096 for buffers of HUGE_PAGE_SIZE or more,
+    //return NULL if there is no memory
+    static void* Alloc(size_t len, size_t align = 4096);
+    //len is the one given to Alloc
+    static void Free(void* ptr, size_t len);
+
+    //Bytes of the buffers in use on hugetlbfs pages
+    static uint64_t HugetlbBytes();
+    //Bytes of the buffers in use advised for transparent huge pages
+    static uint64_t AdvisedBytes();
+    //Bytes of the process the kernel backs by transparent huge pages
+    static uint64_t ThpBackedBytes();
+};
+
 class Thread {
 public:
     Thread();
@@ -1,69 +1,261 @@
 #ifndef _HLKVDS_WORKQUEUE_H_
 #define _HLKVDS_WORKQUEUE_H_
 
-#include <queue>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <chrono>
-#include <iostream>
+#include <thread>
+
+#include "Db_Structure.h"
 
 namespace hlkvds {
+
+// Blocking for lock-free structures. A waiter calls PrepareWait(), checks
+// its condition once more and only then Wait()s, so a Notify() after the
+// condition turned true is never lost. Notify() costs a fence and a load
+// while nobody waits.
+class EventCount {
+public:
+    EventCount() :
+        epoch_(0), waiters_(0) {
+    }
+
+    uint64_t PrepareWait() {
+        waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch_.load();
+    }
+
+    void CancelWait() {
+        waiters_.fetch_sub(1);
+    }
+
+    //return false on timeout
+    bool Wait(uint64_t key, int64_t usec) {
+        std::unique_lock<std::mutex> l(mtx_);
+        bool woken = cv_.wait_for(l, std::chrono::microseconds(usec),
+                                  [this, key] { return epoch_.load() != key; });
+        waiters_.fetch_sub(1);
+        return woken;
+    }
+
+    void Notify(bool all) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!waiters_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::lock_guard<std::mutex> l(mtx_);
+        epoch_.fetch_add(1);
+        if (all) {
+            cv_.notify_all();
+        } else {
+            cv_.notify_one();
+        }
+    }
+
+private:
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint32_t> waiters_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+// Bounded multi-producer multi-consumer queue of pointers on a ring. Every
+// cell has a sequence number telling whether it waits for a producer or a
+// consumer of the current lap, so producers and consumers only contend on
+// their own position counter. Enqueue blocks while the ring is full,
+// Wait_Dequeue while it is empty, both spin a little before they sleep.
+// Queues given the same not_empty EventCount can be waited on together.
 template <typename T> class WorkQueue {
 public:
     typedef T QueueType;
 
+    WorkQueue(uint32_t capacity = WORK_QUEUE_CAPACITY,
+              EventCount* not_empty = NULL) :
+        cells_(NULL), mask_(1), enqPos_(0), deqPos_(0),
+        notEmpty_(not_empty ? not_empty : &ownNotEmpty_) {
+        //a power of 2, at least 2
+        while (mask_ + 1 < capacity && mask_ < (1U << 30)) {
+            mask_ = (mask_ << 1) | 1;
+        }
+        cells_ = new Cell[mask_ + 1];
+        for (size_t i = 0; i <= mask_; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~WorkQueue() {
+        delete[] cells_;
+    }
+
     void Enqueue(QueueType _work) {
-        std::lock_guard < std::mutex > lck(mtx_);
-        dataQueue_.push(_work);
+        if (tryEnqueue(_work)) {
+            return;
+        }
+        for (;;) {
+            uint64_t key = notFull_.PrepareWait();
+            if (tryEnqueue(_work)) {
+                notFull_.CancelWait();
+                return;
+            }
+            notFull_.Wait(key, WORK_QUEUE_WAIT_MSEC * 1000);
+            if (tryEnqueue(_work)) {
+                return;
+            }
+        }
+    }
+
+    void Enqueue_Notify(QueueType _work) {
+        Enqueue(_work);
+        notEmpty_->Notify(false);
     }
 
+    //NULL if the queue is empty
     QueueType Dequeue() {
-        std::unique_lock < std::mutex > lck(mtx_);
-        if (dataQueue_.empty()) {
-            lck.unlock();
+        QueueType data = NULL;
+        if (!dequeueBatch(&data, 1)) {
             return NULL;
         }
+        notFull_.Notify(false);
+        return data;
+    }
 
-        QueueType data = dataQueue_.front();
-        dataQueue_.pop();
-        lck.unlock();
+    //NULL if nothing came within msec
+    QueueType Wait_Dequeue(int msec = 1000) {
+        QueueType data = NULL;
+        Wait_DequeueBatch(&data, 1, msec);
         return data;
     }
 
-    void Enqueue_Notify(QueueType _work) {
-        std::lock_guard < std::mutex > lck(mtx_);
-        dataQueue_.push(_work);
-        cv_.notify_one();
+    //Take up to max items in queue order, waiting up to msec for the
+    //first one, return how many were taken
+    uint32_t Wait_DequeueBatch(QueueType* out, uint32_t max, int msec = 1000) {
+        return Wait_DequeueBatchFor(out, max, (int64_t) msec * 1000);
     }
 
-    QueueType Wait_Dequeue(int msec = 1000) {
-        std::unique_lock < std::mutex > lck(mtx_);
-if    (cv_.wait_for(lck, std::chrono::milliseconds(msec), [this] {return !dataQueue_.empty();}))
-                    {
-                        QueueType data = dataQueue_.front();
-                        dataQueue_.pop();
-                        return data;
-                    }
-                    else
-                    {
-                        return NULL;
-                    }
-                }
+    //As Wait_DequeueBatch, waiting up to usec microseconds, 0 doesn't wait
+    uint32_t Wait_DequeueBatchFor(QueueType* out, uint32_t max, int64_t usec) {
+        uint32_t num = usec ? spinDequeue(out, max) : dequeueBatch(out, max);
+        if (!num && usec) {
+            uint64_t key = notEmpty_->PrepareWait();
+            num = dequeueBatch(out, max);
+            if (num) {
+                notEmpty_->CancelWait();
+            } else if (notEmpty_->Wait(key, usec)) {
+                num = dequeueBatch(out, max);
+            }
+        }
+        if (num) {
+            notFull_.Notify(num > 1);
+        }
+        return num;
+    }
+
+    bool empty() {
+        return length() == 0;
+    }
 
-                bool empty() {
-                    std::lock_guard<std::mutex> lck(mtx_);
-                    return dataQueue_.empty();
+    uint32_t length() {
+        size_t deq = deqPos_.load(std::memory_order_relaxed);
+        size_t enq = enqPos_.load(std::memory_order_relaxed);
+        return enq > deq ? (uint32_t)(enq - deq) : 0;
+    }
+
+private:
+    WorkQueue(const WorkQueue&);
+    WorkQueue& operator=(const WorkQueue&);
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        QueueType data;
+    };
+
+    bool tryEnqueue(QueueType data) {
+        size_t pos = enqPos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+            if (dif == 0) {
+                if (enqPos_.compare_exchange_weak(pos, pos + 1,
+                                                  std::memory_order_relaxed)) {
+                    break;
                 }
+            } else if (dif < 0) {
+                //a lap behind, the ring is full
+                return false;
+            } else {
+                pos = enqPos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = data;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
 
-                uint32_t length()
-                {
-                    return dataQueue_.size();
+    //Claim the run of filled cells at the head, up to max, at once
+    uint32_t dequeueBatch(QueueType* out, uint32_t max) {
+        size_t pos = deqPos_.load(std::memory_order_relaxed);
+        uint32_t num;
+        for (;;) {
+            num = 0;
+            while (num < max && num <= mask_) {
+                Cell *cell = &cells_[(pos + num) & mask_];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                if (seq != pos + num + 1) {
+                    break;
                 }
+                num++;
+            }
+            if (!num) {
+                //empty, unless another consumer moved the head
+                size_t cur = deqPos_.load(std::memory_order_relaxed);
+                if (cur == pos) {
+                    return 0;
+                }
+                pos = cur;
+                continue;
+            }
+            if (deqPos_.compare_exchange_weak(pos, pos + num,
+                                              std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < num; i++) {
+            Cell *cell = &cells_[(pos + i) & mask_];
+            out[i] = cell->data;
+            cell->seq.store(pos + i + mask_ + 1, std::memory_order_release);
+        }
+        return num;
+    }
 
-            private:
-                std::queue<QueueType> dataQueue_;
-                mutable std::mutex mtx_;
-                std::condition_variable cv_;
+    uint32_t spinDequeue(QueueType* out, uint32_t max) {
+        for (int i = 0; i < WORK_QUEUE_SPIN_NUM; i++) {
+            uint32_t num = dequeueBatch(out, max);
+            if (num) {
+                return num;
+            }
+            std::this_thread::yield();
+        }
+        return 0;
+    }
 
-            };
+    //padded so that producers and consumers never share a cache line,
+    //aligned members would need an aligned new of every owner
+    Cell *cells_;
+    size_t mask_;
+    char pad0_[64];
+    std::atomic<size_t> enqPos_;
+    char pad1_[64];
+    std::atomic<size_t> deqPos_;
+    char pad2_[64];
+    EventCount *notEmpty_;
+    EventCount ownNotEmpty_;
+    EventCount notFull_;
+};
 }
 #endif //#ifndef _HLKVDS_WORKQUEUE_H_
@@ -0,0 +1,17 @@
+#ifndef _HLKVDS_CALLBACK_H_
+#define _HLKVDS_CALLBACK_H_
+
+#include <string>
+#include <functional>
+
+#include "hlkvds/Status.h"
+
+namespace hlkvds {
+//Completions of the asynchronous calls. They run on a DB thread, so they
+//should be quick and must not wait for another call of the DB
+typedef std::function<void(const Status&)> WriteCallback;
+//data is only valid during the call
+typedef std::function<void(const Status&, const std::string& data)> ReadCallback;
+} // namespace hlkvds
+
+#endif //#define _HLKVDS_CALLBACK_H_
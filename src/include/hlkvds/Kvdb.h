@@ -3,11 +3,13 @@
 
 #include <iostream>
 #include <string>
+#include <future>
 
 #include "hlkvds/Options.h"
 #include "hlkvds/Status.h"
 #include "hlkvds/Write_batch.h"
 #include "hlkvds/Iterator.h"
+#include "hlkvds/Callback.h"
 
 using namespace std;
 
@@ -23,11 +25,29 @@ public:
     virtual ~DB();
 
     Status Insert(const char* key, uint32_t key_len, const char* data,
-                uint16_t length);
-    Status Delete(const char* key, uint32_t key_len);
+                uint16_t length, const WriteOptions& wopts = WriteOptions());
+    Status Delete(const char* key, uint32_t key_len,
+                  const WriteOptions& wopts = WriteOptions());
     Status Get(const char* key, uint32_t key_len, string &data);
 
     Status InsertBatch(WriteBatch *batch);
+
+    //Asynchronous calls, they copy key and data and return at once, see
+    //Callback.h for where the callbacks run
+    void InsertAsync(const char* key, uint32_t key_len, const char* data,
+                     uint16_t length, WriteCallback cb,
+                     const WriteOptions& wopts = WriteOptions());
+    std::future<Status> InsertAsync(const char* key, uint32_t key_len,
+                                    const char* data, uint16_t length,
+                                    const WriteOptions& wopts = WriteOptions());
+    void DeleteAsync(const char* key, uint32_t key_len, WriteCallback cb,
+                     const WriteOptions& wopts = WriteOptions());
+    std::future<Status> DeleteAsync(const char* key, uint32_t key_len,
+                                    const WriteOptions& wopts = WriteOptions());
+    void GetAsync(const char* key, uint32_t key_len, ReadCallback cb);
+    std::future<Status> GetAsync(const char* key, uint32_t key_len,
+                                 string &data);
+
     Iterator* NewIterator();
 
     void Do_GC();
@@ -4,21 +4,63 @@
 #include <stdint.h>
 
 namespace hlkvds {
+//function used to digest keys, fixed when the DB is created
+enum DigestType {
+    DIGEST_RMD160 = 0,
+    DIGEST_MURMUR3 = 1
+};
+
+//what the in-memory index keeps of a key, fixed when the DB is created.
+//The lean mode keeps fingerprints only and reads record headers to tell
+//keys of the same fingerprint apart. The paged mode keeps the index on
+//device and caches index_cache_pages of its pages
+enum IndexMode {
+    INDEX_MODE_FULL = 0,
+    INDEX_MODE_LEAN = 1,
+    INDEX_MODE_PAGED = 2
+};
+
 struct Options {
     //use in Create DB
     int segment_size;
     int hashtable_size;
+    int digest_type;
+    int index_mode;
     //int data_aligned_size;
 
     //use in Open DB
     int expired_time;
     int seg_write_thread;
+    //request merge threads, each with its own open segment
+    int req_merge_thread;
+    //threads serving asynchronous gets
+    int read_thread;
     double seg_full_rate;
     double gc_upper_level;
     double gc_lower_level;
+    int checkpoint_interval;
+    int index_cache_pages;
+    //key locks of the index, buckets share them above this number
+    int index_lock_num;
+    //index partitions, each kept on and updated from a NUMA node in turn,
+    //rounded down to a power of 2. 0 or 1 for no partitioning. The paged
+    //mode doesn't partition
+    int index_numa_nodes;
 
     Options();
 };
+
+//per call options of the writes
+struct WriteOptions {
+    //microseconds the write may wait in an open segment for more writes,
+    //0 for the expired_time of the DB. A shorter one flushes the segment
+    //early
+    int max_latency;
+    //the segment holding the write goes to the device ahead of the others
+    bool urgent;
+
+    WriteOptions();
+};
 } // namespace hlkvds
 
 #endif //#define _HLKVDS_OPTIONS_H_
@@ -10,8 +10,10 @@ public:
         code_(kOk), state_(nullptr) {
     }
     ~Status() {
-        delete state_;
+        delete[] state_;
     }
+    Status(const Status& s);
+    Status& operator=(const Status& s);
 
     enum Code {
         kOk = 0,
@@ -68,6 +70,7 @@ private:
     Code code_;
     const char* state_;
     Status(Code _code, const char* msg);
+    static const char* copyState(const char* state);
 
 };
 }
@@ -0,0 +1,26 @@
+/********************************************************************\
+ *
+ *      FILE:     murmur3.h
+ *
+ *      CONTENTS: MurmurHash3, the x64 128-bit variant.
+ *      AUTHOR:   Austin Appleby, placed in the public domain.
+ *
+ \********************************************************************/
+
+#ifndef  MURMUR3H
+#define  MURMUR3H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* hash len bytes of key to 128 bits at out */
+void MurmurHash3_x64_128(const void *key, int len, uint32_t seed, void *out);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* MURMUR3H */
@@ -0,0 +1,35 @@
+/********************************************************************\
+ *
+ *      FILE:     rmd160_mb.h
+ *
+ *      CONTENTS: Multi-buffer RIPEMD-160, hashes several messages
+ *                at once in the lanes of a vector.
+ *      TARGET:   gcc, the widest vector unit is picked at runtime
+ *
+ \********************************************************************/
+
+#ifndef  RMD160MBH
+#define  RMD160MBH
+
+#include "rmd160.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* number of messages compressed together */
+#define RMD_MB_LANES 16
+
+void MDmulti(const byte *const *msgs, const dword *lens, dword num,
+             dword *MDbufs);
+/*
+ *  computes RMD(msgs[i]) of lens[i] bytes for i < num,
+ *  MDbufs[5 * i] through MDbufs[5 * i + 4] receive (A, B, C, D, E)
+ *  as MDinit()/compress_()/MDfinish() would leave them.
+ */
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* RMD160MBH */
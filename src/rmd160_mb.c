@@ -0,0 +1,190 @@
+/********************************************************************\
+ *
+ *      FILE:     rmd160_mb.c
+ *
+ *      CONTENTS: Multi-buffer RIPEMD-160, each lane of a vector
+ *                carries the state of one message. Lanes are padded
+ *                like MDfinish() and masked once their message is done,
+ *                so every digest is bit-identical to rmd160.c.
+ *      TARGET:   gcc vector extensions, cloned for AVX-512/AVX2 with
+ *                an SSE2/scalar default selected when loading.
+ *
+ \********************************************************************/
+
+#include <string.h>
+#include "rmd160_mb.h"
+
+typedef dword mbvec __attribute__((vector_size(RMD_MB_LANES * sizeof(dword))));
+
+#if defined(__x86_64__) && !defined(__clang__)
+#define MB_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define MB_TARGETS
+#endif
+
+/* message word and rotation of each step, left and right line */
+static const byte RL[80] = {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+     7,  4, 13,  1, 10,  6, 15,  3, 12,  0,  9,  5,  2, 14, 11,  8,
+     3, 10, 14,  4,  9, 15,  8,  1,  2,  7,  0,  6, 13, 11,  5, 12,
+     1,  9, 11, 10,  0,  8, 12,  4, 13,  3,  7, 15, 14,  5,  6,  2,
+     4,  0,  5,  9,  7, 12,  2, 10, 14,  1,  3,  8, 11,  6, 15, 13 };
+static const byte RR[80] = {
+     5, 14,  7,  0,  9,  2, 11,  4, 13,  6, 15,  8,  1, 10,  3, 12,
+     6, 11,  3,  7,  0, 13,  5, 10, 14, 15,  8, 12,  4,  9,  1,  2,
+    15,  5,  1,  3,  7, 14,  6,  9, 11,  8, 12,  2, 10,  0,  4, 13,
+     8,  6,  4,  1,  3, 11, 15,  0,  5, 12,  2, 13,  9,  7, 10, 14,
+    12, 15, 10,  4,  1,  5,  8,  7,  6,  2, 13, 14,  0,  3,  9, 11 };
+static const byte SL[80] = {
+    11, 14, 15, 12,  5,  8,  7,  9, 11, 13, 14, 15,  6,  7,  9,  8,
+     7,  6,  8, 13, 11,  9,  7, 15,  7, 12, 15,  9, 11,  7, 13, 12,
+    11, 13,  6,  7, 14,  9, 13, 15, 14,  8, 13,  6,  5, 12,  7,  5,
+    11, 12, 14, 15, 14, 15,  9,  8,  9, 14,  5,  6,  8,  6,  5, 12,
+     9, 15,  5, 11,  6,  8, 13, 12,  5, 12, 13, 14, 11,  8,  5,  6 };
+static const byte SR[80] = {
+     8,  9,  9, 11, 13, 15, 15,  5,  7,  7,  8, 11, 14, 14, 12,  6,
+     9, 13, 15,  7, 12,  8,  9, 11,  7,  7, 12,  7,  6, 15, 13, 11,
+     9,  7, 15, 11,  8,  6,  6, 14, 12, 13,  5, 14, 13, 13,  7,  5,
+    15,  5,  8, 11, 14, 14,  6, 14,  6,  9, 12,  9, 12,  5, 15,  8,
+     8,  5, 12,  9, 12,  5, 14,  6,  8, 13,  6,  5, 15, 13, 11, 11 };
+static const dword KL[5] = {
+    0x00000000UL, 0x5a827999UL, 0x6ed9eba1UL, 0x8f1bbcdcUL, 0xa953fd4eUL };
+static const dword KR[5] = {
+    0x50a28be6UL, 0x5c4dd124UL, 0x6d703ef3UL, 0x7a6d76e9UL, 0x00000000UL };
+
+/********************************************************************/
+
+/* basic function of round j, the right line runs them backwards */
+#define MB_F(j, x, y, z)                        \
+    ((j) == 0 ? F1((x), (y), (z)) :             \
+     (j) == 1 ? G((x), (y), (z)) :              \
+     (j) == 2 ? H((x), (y), (z)) :              \
+     (j) == 3 ? I((x), (y), (z)) : J((x), (y), (z)))
+
+/*
+ *  compresses one block in every lane,
+ *  lanes with a zero in active keep their state.
+ */
+MB_TARGETS
+static void MDmulti_compress(mbvec *MDbuf, const mbvec *X, const mbvec *active) {
+    mbvec al = MDbuf[0], bl = MDbuf[1], cl = MDbuf[2], dl = MDbuf[3], el =
+            MDbuf[4];
+    mbvec ar = MDbuf[0], br = MDbuf[1], cr = MDbuf[2], dr = MDbuf[3], er =
+            MDbuf[4];
+    mbvec t;
+    int i, j;
+
+    for (i = 0; i < 80; i++) {
+        j = i >> 4;
+
+        t = al + MB_F(j, bl, cl, dl) + X[RL[i]] + KL[j];
+        t = ROL(t, SL[i]) + el;
+        al = el; el = dl; dl = ROL(cl, 10); cl = bl; bl = t;
+
+        t = ar + MB_F(4 - j, br, cr, dr) + X[RR[i]] + KR[j];
+        t = ROL(t, SR[i]) + er;
+        ar = er; er = dr; dr = ROL(cr, 10); cr = br; br = t;
+    }
+
+    /* combine results, as compress_() */
+    t = MDbuf[1] + cl + dr;
+    mbvec m[5];
+    m[1] = MDbuf[2] + dl + er;
+    m[2] = MDbuf[3] + el + ar;
+    m[3] = MDbuf[4] + al + br;
+    m[4] = MDbuf[0] + bl + cr;
+    m[0] = t;
+
+    for (i = 0; i < 5; i++) {
+        MDbuf[i] = (m[i] & *active) | (MDbuf[i] & ~*active);
+    }
+}
+
+/********************************************************************/
+
+/* number of blocks of a message of len bytes once padded */
+static dword MDblocks(dword len) {
+    return (len + 8) / 64 + 1;
+}
+
+/* block b of the padded message, laid out as MDfinish() does */
+static void MDblock(const byte *msg, dword len, dword b, dword *X) {
+    dword off = b * 64;
+    dword i;
+
+    if (off + 64 <= len) {
+        for (i = 0; i < 16; i++) {
+            X[i] = BYTES_TO_DWORD(msg + off + 4 * i);
+        }
+        return;
+    }
+
+    memset(X, 0, 16 * sizeof(dword));
+    for (i = 0; off + i < len; i++) {
+        X[i >> 2] ^= (dword) msg[off + i] << (8 * (i & 3));
+    }
+    if (off <= len) {
+        /* append the bit m_n == 1 */
+        X[(len >> 2) & 15] ^= (dword) 1 << (8 * (len & 3) + 7);
+    }
+    if (b == MDblocks(len) - 1) {
+        /* append length in bits */
+        X[14] = len << 3;
+        X[15] = len >> 29;
+    }
+}
+
+/********************************************************************/
+
+void MDmulti(const byte *const *msgs, const dword *lens, dword num,
+             dword *MDbufs) {
+    static const dword init[5] = {
+        0x67452301UL, 0xefcdab89UL, 0x98badcfeUL, 0x10325476UL, 0xc3d2e1f0UL };
+    mbvec MDbuf[5];
+    mbvec X[16];
+    mbvec active;
+    dword word[16];
+    dword base, lanes, max_blocks, b, l, i;
+
+    for (base = 0; base < num; base += RMD_MB_LANES) {
+        lanes = num - base < RMD_MB_LANES ? num - base : RMD_MB_LANES;
+
+        max_blocks = 0;
+        for (l = 0; l < lanes; l++) {
+            if (MDblocks(lens[base + l]) > max_blocks) {
+                max_blocks = MDblocks(lens[base + l]);
+            }
+        }
+
+        for (i = 0; i < 5; i++) {
+            for (l = 0; l < RMD_MB_LANES; l++) {
+                MDbuf[i][l] = init[i];
+            }
+        }
+
+        for (b = 0; b < max_blocks; b++) {
+            /* transpose block b of each message into the lanes */
+            for (l = 0; l < RMD_MB_LANES; l++) {
+                if (l < lanes && b < MDblocks(lens[base + l])) {
+                    MDblock(msgs[base + l], lens[base + l], b, word);
+                    active[l] = ~0U;
+                } else {
+                    memset(word, 0, sizeof(word));
+                    active[l] = 0;
+                }
+                for (i = 0; i < 16; i++) {
+                    X[i][l] = word[i];
+                }
+            }
+            MDmulti_compress(MDbuf, X, &active);
+        }
+
+        for (l = 0; l < lanes; l++) {
+            for (i = 0; i < 5; i++) {
+                MDbufs[5 * (base + l) + i] = MDbuf[i][l];
+            }
+        }
+    }
+}
+
+/************************ end of file rmd160_mb.c *******************/
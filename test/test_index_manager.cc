@@ -1,6 +1,9 @@
 #include <string>
 #include <iostream>
+#include <thread>
+#include <atomic>
 #include "test_base.h"
+#include "HashTable.h"
 
 class IndexManagerTest : public TestBase {
 public:
@@ -23,10 +26,306 @@ public:
 TEST_F(IndexManagerTest, ComputeIndexSizeOnDevice)
 {
     uint32_t ht_size=10;
-    EXPECT_EQ(4096,IndexManager::ComputeIndexSizeOnDevice(ht_size));
+    EXPECT_EQ(8192,IndexManager::ComputeIndexSizeOnDevice(ht_size));
 
 }
 
+TEST_F(IndexManagerTest, HashEntryInline)
+{
+    //just the on-disk entry, nothing on the heap
+    EXPECT_EQ(IndexManager::SizeOfHashEntryOnDisk(), sizeof(HashEntry));
+}
+
+static uint32_t countEntries(HashTable& ht)
+{
+    vector<HashEntry> entries;
+    for (uint32_t i = 0; i < ht.GetBucketNum(); i++) {
+        ht.GetEntries(i, entries);
+    }
+    return entries.size();
+}
+
+static HashEntry newEntry(KVSlice& slice, uint64_t offset)
+{
+    DataHeader header;
+    header.SetDigest(slice.GetDigest());
+    return HashEntry(header, offset);
+}
+
+TEST_F(IndexManagerTest, HashTableOverflowBucket)
+{
+    //2 buckets only, most entries go to overflow buckets
+    HashTable ht(16);
+    EXPECT_EQ(2U, ht.GetBucketNum());
+
+    int key_num = 100;
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        HashEntry entry = newEntry(slice, i);
+        EXPECT_TRUE(ht.Put(entry));
+        EXPECT_FALSE(ht.Put(entry));
+    }
+    EXPECT_EQ((uint32_t)key_num, countEntries(ht));
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        HashEntry *entry = ht.Get(slice.GetDigest());
+        ASSERT_TRUE(entry != NULL);
+        EXPECT_EQ((uint64_t)i, entry->GetHeaderOffsetPhy());
+        if (i % 2) {
+            EXPECT_TRUE(ht.Remove(slice.GetDigest()));
+            EXPECT_TRUE(ht.Get(slice.GetDigest()) == NULL);
+        }
+    }
+    EXPECT_EQ((uint32_t)key_num / 2, countEntries(ht));
+}
+
+TEST_F(IndexManagerTest, LeanHashTableSameFingerprint)
+{
+    //12 bytes a slot, the tag is in the bucket
+    EXPECT_EQ(12U, sizeof(LeanEntry));
+
+    LeanHashTable ht(16);
+    KVSlice slice("key", 3, NULL, 0);
+    const Kvdb_Digest &digest = slice.GetDigest();
+    uint64_t big_offset = (1ULL << 40) + 7;
+
+    //other keys of the fingerprint are told apart by their offsets
+    EXPECT_TRUE(ht.Put(newEntry(slice, 4096), LeanHashTable::NO_OFFSET));
+    EXPECT_TRUE(ht.Put(newEntry(slice, big_offset), LeanHashTable::NO_OFFSET));
+    vector<HashEntry> entries;
+    ht.Lookup(digest, entries);
+    ASSERT_EQ(2U, entries.size());
+    Kvdb_Digest fingerprint = entries[0].GetKeyDigest();
+    EXPECT_EQ(KeyDigestHandle::Hash(&digest), KeyDigestHandle::Hash(&fingerprint));
+    EXPECT_EQ(KeyDigestHandle::Tag(&digest), KeyDigestHandle::Tag(&fingerprint));
+
+    //an overwrite replaces the entry at the old offset only
+    EXPECT_FALSE(ht.Put(newEntry(slice, 8192), 4096));
+    entries.clear();
+    ht.Lookup(digest, entries);
+    ASSERT_EQ(2U, entries.size());
+    EXPECT_EQ(8192U + big_offset,
+              entries[0].GetHeaderOffsetPhy() + entries[1].GetHeaderOffsetPhy());
+
+    EXPECT_TRUE(ht.Remove(digest, big_offset));
+    EXPECT_FALSE(ht.Remove(digest, big_offset));
+    entries.clear();
+    ht.Lookup(digest, entries);
+    ASSERT_EQ(1U, entries.size());
+    EXPECT_EQ(8192U, entries[0].GetHeaderOffsetPhy());
+}
+
+TEST_F(IndexManagerTest, HashTableIncrementalResize)
+{
+    HashTable ht(16);
+
+    //grow while keys keep coming, entries stay reachable mid-migration
+    int key_num = 1000;
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        ht.MigrateStep();
+        EXPECT_TRUE(ht.Put(newEntry(slice, i)));
+        ht.CheckResize(i + 1);
+        EXPECT_EQ((uint32_t)i + 1, countEntries(ht));
+    }
+    EXPECT_LT(2U, ht.GetBucketNum());
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        HashEntry *entry = ht.Get(slice.GetDigest());
+        ASSERT_TRUE(entry != NULL);
+        EXPECT_EQ((uint64_t)i, entry->GetHeaderOffsetPhy());
+    }
+
+    //shrink back to the initial size as keys are removed
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        ht.MigrateStep();
+        EXPECT_TRUE(ht.Remove(slice.GetDigest()));
+        ht.CheckResize(key_num - i - 1);
+    }
+    for (int i = 0; i < 100 && ht.GetBucketNum() > 2; i++) {
+        ht.MigrateStep();
+        ht.CheckResize(0);
+    }
+    EXPECT_EQ(2U, ht.GetBucketNum());
+    EXPECT_EQ(0U, countEntries(ht));
+}
+
+TEST_F(IndexManagerTest, HashTableLockStriping)
+{
+    //128 buckets share 4 locks, and keep sharing them as the table grows
+    HashTable ht(1024, 4);
+    EXPECT_EQ(128U, ht.GetBucketNum());
+
+    int key_num = 2000;
+    std::set<std::mutex*> locks;
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        ht.MigrateStep();
+        std::mutex *lock = &ht.GetLock(slice.GetDigest());
+        locks.insert(lock);
+        lock->lock();
+        EXPECT_TRUE(ht.Put(newEntry(slice, i)));
+        lock->unlock();
+        ht.CheckResize(i + 1);
+    }
+    EXPECT_EQ(4U, locks.size());
+    EXPECT_LT(128U, ht.GetBucketNum());
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        HashEntry entry;
+        ASSERT_TRUE(ht.Lookup(slice.GetDigest(), entry));
+        EXPECT_EQ((uint64_t)i, entry.GetHeaderOffsetPhy());
+    }
+}
+
+TEST_F(IndexManagerTest, HashTableNumaPartition)
+{
+    //2 chunks of buckets for 2 partitions, a key keeps its partition
+    //as the table grows
+    HashTable ht(2 * INDEX_NUMA_CHUNK * BUCKET_ENTRY_NUM, INDEX_LOCK_NUM, 3);
+    uint32_t bucket_num = ht.GetBucketNum();
+    EXPECT_EQ(2U * INDEX_NUMA_CHUNK, bucket_num);
+
+    int key_num = 5000;
+    vector<uint32_t> nodes;
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        uint32_t no = KeyDigestHandle::Hash(&slice.GetDigest()) & (bucket_num - 1);
+        nodes.push_back(ht.GetNode(slice.GetDigest()));
+        EXPECT_EQ(no / INDEX_NUMA_CHUNK % 2, nodes.back());
+
+        ht.MigrateStep();
+        std::lock_guard<std::mutex> l(ht.GetLock(slice.GetDigest()));
+        ht.Put(newEntry(slice, i));
+    }
+    for (int i = 0; i < key_num; i++) {
+        ht.MigrateStep();
+        ht.CheckResize(key_num);
+    }
+    EXPECT_LT(bucket_num, ht.GetBucketNum());
+    EXPECT_FALSE(ht.IsResizing());
+
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        EXPECT_EQ(nodes[i], ht.GetNode(slice.GetDigest()));
+        HashEntry entry;
+        ASSERT_TRUE(ht.Lookup(slice.GetDigest(), entry));
+        EXPECT_EQ((uint64_t)i, entry.GetHeaderOffsetPhy());
+    }
+}
+
+TEST_F(IndexManagerTest, HashTableHugePages)
+{
+    //buckets of a large table are on huge pages, or plain ones without
+    uint64_t huge_bytes = KVHugeMem::HugetlbBytes() + KVHugeMem::AdvisedBytes();
+    HashTable ht(1U << 20);
+    EXPECT_LE(huge_bytes, KVHugeMem::HugetlbBytes() + KVHugeMem::AdvisedBytes());
+
+    int key_num = 1000;
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        EXPECT_TRUE(ht.Put(newEntry(slice, i)));
+    }
+    for (int i = 0; i < key_num; i++) {
+        string key = "key_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        HashEntry entry;
+        ASSERT_TRUE(ht.Lookup(slice.GetDigest(), entry));
+        EXPECT_EQ((uint64_t)i, entry.GetHeaderOffsetPhy());
+    }
+
+    //small buffers stay plain
+    void *buf = KVHugeMem::Alloc(4096);
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_EQ(0U, (uint64_t) buf % 4096);
+    KVHugeMem::Free(buf, 4096);
+
+    buf = KVHugeMem::Alloc(HUGE_PAGE_SIZE + 1);
+    ASSERT_TRUE(buf != NULL);
+    EXPECT_EQ(0U, (uint64_t) buf % HUGE_PAGE_SIZE);
+    memset(buf, 1, HUGE_PAGE_SIZE + 1);
+    KVHugeMem::Free(buf, HUGE_PAGE_SIZE + 1);
+}
+
+TEST_F(IndexManagerTest, HashTableLookupWhileResize)
+{
+    HashTable ht(16);
+
+    //keys readers look up, they are never changed
+    int stable_num = 200;
+    for (int i = 0; i < stable_num; i++) {
+        string key = "stable_" + to_string(i);
+        KVSlice slice(key.c_str(), key.size(), NULL, 0);
+        ht.Put(newEntry(slice, i));
+    }
+    ht.CheckResize(stable_num);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> wrong(0);
+    vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.push_back(std::thread([&]() {
+            while (!stop.load()) {
+                for (int i = 0; i < stable_num; i++) {
+                    string key = "stable_" + to_string(i);
+                    KVSlice slice(key.c_str(), key.size(), NULL, 0);
+                    HashEntry entry;
+                    if (!ht.Lookup(slice.GetDigest(), entry)
+                            || entry.GetHeaderOffsetPhy() != (uint64_t)i) {
+                        wrong++;
+                    }
+                }
+            }
+        }));
+    }
+
+    //grow and shrink the table with other keys meanwhile
+    int key_num = 3000;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < key_num; i++) {
+            string key = "key_" + to_string(i);
+            KVSlice slice(key.c_str(), key.size(), NULL, 0);
+            ht.MigrateStep();
+            {
+                std::lock_guard<std::mutex> l(ht.GetLock(slice.GetDigest()));
+                ht.Put(newEntry(slice, i));
+            }
+            ht.CheckResize(stable_num + i + 1);
+        }
+        for (int i = 0; i < key_num; i++) {
+            string key = "key_" + to_string(i);
+            KVSlice slice(key.c_str(), key.size(), NULL, 0);
+            ht.MigrateStep();
+            {
+                std::lock_guard<std::mutex> l(ht.GetLock(slice.GetDigest()));
+                ht.Remove(slice.GetDigest());
+            }
+            ht.CheckResize(stable_num + key_num - i - 1);
+        }
+    }
+
+    stop.store(true);
+    for (size_t t = 0; t < readers.size(); t++) {
+        readers[t].join();
+    }
+    EXPECT_EQ(0, wrong.load());
+    EXPECT_EQ((uint32_t)stable_num, countEntries(ht));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
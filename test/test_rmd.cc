@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <set>
+#include <vector>
 #include <iomanip>
 #include "test_base.h"
 #include "KeyDigestHandle.h"
@@ -82,6 +83,30 @@ TEST_F(test_rmd, RegularTest)
 
 }
 
+TEST_F(test_rmd, MultiBufferTest)
+{
+    //lengths cross the one and two padding block boundaries at 55/56 and 64
+    int key_num = 200;
+    string raw;
+    for (int i = 0; i < key_num; i++) {
+        raw.push_back('a' + i % 26);
+    }
+
+    vector<hlkvds::Kvdb_Key> keys;
+    for (int i = 0; i < key_num; i++) {
+        keys.push_back(hlkvds::Kvdb_Key(raw.c_str(), i));
+    }
+    vector<hlkvds::Kvdb_Digest> digests(key_num);
+    KeyDigestHandle::ComputeDigests(keys.data(), digests.data(), key_num,
+                                    hlkvds::DIGEST_RMD160);
+
+    for (int i = 0; i < key_num; i++) {
+        hlkvds::Kvdb_Digest result;
+        KeyDigestHandle::ComputeDigest(&keys[i], result);
+        EXPECT_TRUE(result == digests[i]) << "key length " << i;
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -55,6 +55,28 @@ TEST_F(test_segment_manager, InitSegment)
 
 }
 
+TEST_F(test_segment_manager, SegBufPool)
+{
+    uint64_t seg_size=4096;
+    EXPECT_TRUE(segMgr_->InitSegmentForCreateDB(0,seg_size,9));
+
+    //one buffer per merge thread, write thread and GC segment
+    uint32_t pool_num = opts.req_merge_thread + opts.seg_write_thread
+            + SEG_RESERVED_FOR_GC;
+    vector<char*> bufs;
+    for (uint32_t i = 0; i < pool_num + 1; i++) {
+        char *buf = segMgr_->GetSegBuf();
+        ASSERT_TRUE(NULL != buf);
+        EXPECT_EQ(0, (uint64_t) buf % 4096);
+        bufs.push_back(buf);
+    }
+    for (uint32_t i = 0; i < bufs.size(); i++) {
+        segMgr_->PutSegBuf(bufs[i]);
+    }
+    //the last one back from the pool is taken first
+    EXPECT_EQ(bufs[pool_num - 1], segMgr_->GetSegBuf());
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
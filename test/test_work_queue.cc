@@ -0,0 +1,81 @@
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "test_base.h"
+#include "WorkQueue.h"
+
+class WorkQueueTest : public TestBase {
+};
+
+TEST_F(WorkQueueTest, BatchInOrder)
+{
+    WorkQueue<long*> que(8);
+    EXPECT_TRUE(que.empty());
+    EXPECT_TRUE(NULL == que.Dequeue());
+    EXPECT_TRUE(NULL == que.Wait_Dequeue(1));
+
+    long items[8];
+    for (int i = 0; i < 8; i++) {
+        que.Enqueue_Notify(&items[i]);
+    }
+    EXPECT_EQ(8U, que.length());
+
+    long *out[8];
+    EXPECT_EQ(3U, que.Wait_DequeueBatch(out, 3));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(&items[i], out[i]);
+    }
+    EXPECT_EQ(&items[3], que.Dequeue());
+    EXPECT_EQ(4U, que.Wait_DequeueBatch(out, 8));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(&items[i + 4], out[i]);
+    }
+    EXPECT_TRUE(que.empty());
+}
+
+TEST_F(WorkQueueTest, ProducersAndConsumers)
+{
+    //a small ring, so producers block on it being full
+    WorkQueue<long*> que(16);
+    int thd_num = 4;
+    long item_num = 20000;
+    vector<long> items(thd_num * item_num);
+    vector<std::atomic<int> > seen(items.size());
+    for (size_t i = 0; i < seen.size(); i++) {
+        seen[i].store(0);
+    }
+
+    std::atomic<long> taken(0);
+    vector<std::thread> thds;
+    for (int t = 0; t < thd_num; t++) {
+        thds.push_back(std::thread([&, t] {
+            for (long i = 0; i < item_num; i++) {
+                que.Enqueue_Notify(&items[t * item_num + i]);
+            }
+        }));
+        thds.push_back(std::thread([&] {
+            long *out[8];
+            while (taken.load() < (long) items.size()) {
+                uint32_t num = que.Wait_DequeueBatch(out, 8, 10);
+                for (uint32_t i = 0; i < num; i++) {
+                    seen[out[i] - &items[0]]++;
+                }
+                taken += num;
+            }
+        }));
+    }
+    for (auto &th : thds) {
+        th.join();
+    }
+
+    EXPECT_EQ((long) items.size(), taken.load());
+    for (size_t i = 0; i < seen.size(); i++) {
+        ASSERT_EQ(1, seen[i].load());
+    }
+    EXPECT_TRUE(que.empty());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}